@@ -23,6 +23,7 @@ using namespace nlxml;
 
 namespace std {
    %template(UIntVector) vector<uint32_t>;
+   %template(IntVector) vector<int32_t>;
    %template(FloatVector) vector<float>;
 
    %template(PointVector) vector<nlxml::Point>;
@@ -32,6 +33,23 @@ namespace std {
    %template(ContourVector) vector<nlxml::Contour>;
    %template(MarkerVector) vector<nlxml::Marker>;
    %template(ImageVector) vector<nlxml::Image>;
+   %template(ElementInfoVector) vector<nlxml::ElementInfo>;
+   %template(FlatBranchVector) vector<nlxml::FlatBranch>;
+   %template(FlatTreeVector) vector<nlxml::FlatTree>;
+   %template(FlatMarkerVector) vector<nlxml::FlatMarker>;
+   %template(FlatContourVector) vector<nlxml::FlatContour>;
 };
 
+%ignore nlxml::MappedFile::MappedFile(MappedFile &&);
+%ignore nlxml::MappedFile::operator=;
+%ignore nlxml::ImportOptions::tree_filter;
+%ignore nlxml::export_stream;
+%ignore nlxml::export_swc_stream;
+%ignore nlxml::export_swc_file;
+%ignore nlxml::SWCStreamWriter::SWCStreamWriter(std::FILE *, const SWCExportOptions &);
+%ignore nlxml::BinaryNeuronFile::x;
+%ignore nlxml::BinaryNeuronFile::y;
+%ignore nlxml::BinaryNeuronFile::z;
+%ignore nlxml::BinaryNeuronFile::d;
+
 %include "./nlxml.h"
\ No newline at end of file
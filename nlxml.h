@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include <array>
+#include <cstdio>
+#include <functional>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -81,9 +84,662 @@ struct NeuronData {
 	std::vector<Marker> markers;
 };
 
+/* A flat structure-of-arrays form of NeuronData. Every point in the data
+ * is stored in the x, y, z and d arrays, and the branches, markers and
+ * contours refer to contiguous ranges of them. Strings are interned in
+ * the strings table and referred to by their index.
+ */
+struct FlatBranch {
+	// The index of the parent branch, or -1 for the root branch of a tree
+	int32_t parent;
+	uint32_t first_point, num_points;
+	// Index of the leaf string
+	uint32_t leaf;
+};
+
+struct FlatTree {
+	Color color;
+	uint32_t type;
+	// The tree's own points, leaf and markers are stored on its root branch,
+	// which is followed by the tree's other branches in depth-first order
+	uint32_t root_branch, num_branches;
+};
+
+struct FlatMarker {
+	// The index of the branch or contour the marker is placed on, or -1
+	// for a top-level marker
+	int32_t owner;
+	bool on_contour;
+	uint32_t type, name;
+	Color color;
+	bool varicosity;
+	uint32_t first_point, num_points;
+};
+
+struct FlatContour {
+	uint32_t name, shape;
+	Color color;
+	bool closed;
+	uint32_t first_point, num_points;
+};
+
+struct FlatNeuronData {
+	std::vector<float> x, y, z, d;
+	std::vector<std::string> strings;
+	std::vector<FlatBranch> branches;
+	std::vector<FlatTree> trees;
+	// Markers on the same owner are stored in the order they were placed
+	std::vector<FlatMarker> markers;
+	std::vector<FlatContour> contours;
+	std::vector<Image> images;
+
+	size_t num_points() const;
+	Point point(size_t i) const;
+};
+
+FlatNeuronData to_flat(const NeuronData &data);
+
+NeuronData from_flat(const FlatNeuronData &flat);
+
+// Binary files written by save_binary are also accepted
 NeuronData import_file(const std::string &fname);
 
-void export_file(const NeuronData &data, const std::string &fname);
+/* Which of the file's image transform, mapping its first image's voxels
+ * into the file's space as translate(coord) * scale(scale[0], scale[1],
+ * z_spacing), is applied to the points on import. INVERT takes them into the
+ * image's voxel space. Files without images are left as they are.
+ */
+enum class ImageTransform { NONE, APPLY, INVERT };
+
+/* Selects the parts of a file to import and how. Elements which aren't
+ * selected are stepped over in the file without being parsed, so nothing
+ * is allocated for them.
+ */
+struct ImportOptions {
+	// Import the top-level contours, markers and images
+	bool contours = true;
+	bool markers = true;
+	bool images = true;
+	// Import the markers placed on trees, branches and contours
+	bool branch_markers = true;
+	// Only trees whose type this returns true for are imported, all trees
+	// are imported if it's empty
+	std::function<bool(const std::string &type)> tree_filter;
+	// Parse the top-level elements on this many threads, or all hardware
+	// threads if 0. See import_file_parallel
+	size_t num_threads = 1;
+	// Transform the points as they're read by this affine matrix, 16 floats
+	// stored column major as for transform(), instead of in a second pass.
+	// No transform is applied if it's empty. The images are left as they are
+	std::vector<float> matrix;
+	// Apply the file's image transform, or its inverse, before the matrix
+	ImageTransform image_transform = ImageTransform::NONE;
+};
+
+// Import the parts of the file selected by the options. This uses the
+// streaming importer, with all options left as default the result is the
+// same as import_file. Binary files written by save_binary are loaded and
+// then have the options applied, giving the same result as the XML
+NeuronData import_file(const std::string &fname, const ImportOptions &options);
+
+/* Receives the contents of an NLXML file as it's read by parse_file or
+ * parse_buffer, without building a DOM or NeuronData. Each begin_* call
+ * is matched by an end_* call once the element's points, markers and
+ * child branches have been passed on, and points and markers belong to
+ * the most recently begun element which hasn't ended. Elements are passed
+ * in the order they appear in the file.
+ */
+class ImportHandler {
+public:
+	virtual ~ImportHandler();
+	// The tree and contour passed have their attributes set but no points,
+	// branches or markers yet
+	virtual void begin_tree(const Tree &tree);
+	virtual void end_tree();
+	virtual void begin_branch(const std::string &leaf);
+	virtual void end_branch();
+	virtual void begin_contour(const Contour &contour);
+	virtual void end_contour();
+	virtual void begin_marker(const Marker &marker);
+	virtual void end_marker();
+	virtual void point(const Point &p);
+	virtual void image(const Image &image);
+};
+
+/* A read-only memory mapping of a file, the pages are read in from the
+ * page cache as they're accessed instead of the file being copied into
+ * a buffer up front.
+ */
+class MappedFile {
+	const char *ptr;
+	size_t len;
+	// Windows file and mapping handles, unused elsewhere
+	void *file, *mapping;
+
+public:
+	MappedFile();
+	// Throws a std::runtime_error if the file can't be opened and mapped
+	MappedFile(const std::string &fname);
+	MappedFile(MappedFile &&m);
+	MappedFile& operator=(MappedFile &&m);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile& operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	const char* data() const;
+	size_t size() const;
+
+private:
+	void close();
+};
+
+// Stream the NLXML file through the handler in a single pass. The file is
+// memory mapped and parsed in place without being copied. The options'
+// num_threads is ignored, the handler is always called from this thread
+void parse_file(const std::string &fname, ImportHandler &handler,
+		const ImportOptions &options = ImportOptions());
+
+void parse_buffer(const char *data, size_t size, ImportHandler &handler,
+		const ImportOptions &options = ImportOptions());
+
+// Import the file through parse_file, the result is the same as import_file
+// but no tinyxml2 DOM is built, using much less memory for large files
+NeuronData import_file_stream(const std::string &fname);
+
+// Import an NLXML document already in memory, the buffer is read in place
+// and doesn't need to be null terminated
+NeuronData import_buffer(const char *data, size_t size, const ImportOptions &options = ImportOptions());
+
+// Import the file straight into the flat representation, without building a
+// NeuronData or DOM. The result is the same as to_flat(import_file(fname, options))
+// up to the order the points are stored in
+FlatNeuronData import_file_flat(const std::string &fname, const ImportOptions &options = ImportOptions());
+
+FlatNeuronData import_buffer_flat(const char *data, size_t size, const ImportOptions &options = ImportOptions());
+
+/* Import the file with its top-level trees, contours, markers and images
+ * parsed in parallel on num_threads threads, or all hardware threads if 0.
+ * The elements are split out by a quick scan of the file and parsed
+ * independently, the result is the same as import_file.
+ */
+NeuronData import_file_parallel(const std::string &fname, size_t num_threads = 0);
+
+NeuronData import_buffer_parallel(const char *data, size_t size, size_t num_threads = 0);
+
+enum class ElementKind { TREE, CONTOUR, MARKER, IMAGES };
+
+// A top-level element of an NLXML file, as found by LazyNeuronFile's pre-scan
+struct ElementInfo {
+	ElementKind kind;
+	// The byte range of the element in the file
+	size_t begin, end;
+	// The tree or marker type, empty for contours and images
+	std::string type;
+	// The contour or marker name, empty for trees and images
+	std::string name;
+	Color color;
+	// The number of points anywhere in the element, including marker points
+	size_t num_points;
+};
+
+/* Opens an NLXML file and indexes its top-level trees, contours, markers
+ * and images without parsing them, so individual elements can be loaded
+ * on demand. The file stays memory mapped while the LazyNeuronFile is open.
+ */
+class LazyNeuronFile {
+	MappedFile file;
+	std::vector<ElementInfo> index;
+
+public:
+	LazyNeuronFile(const std::string &fname);
+
+	// The top-level elements in the order they appear in the file
+	const std::vector<ElementInfo>& elements() const;
+
+	// Load element i of the index, these throw if it's not of the kind requested
+	Tree load_tree(size_t i) const;
+	Contour load_contour(size_t i) const;
+	Marker load_marker(size_t i) const;
+	std::vector<Image> load_images(size_t i) const;
+
+	// Stream element i through the handler
+	void parse_element(size_t i, ImportHandler &handler,
+			const ImportOptions &options = ImportOptions()) const;
+};
+
+// The version of the binary format written by save_binary
+const uint32_t BINARY_VERSION = 2;
+
+/* Save the data in a compact binary form which loads much faster than the
+ * XML, to use as a cache. The points are stored as flat arrays which can be
+ * used straight from the mapped file by BinaryNeuronFile, see
+ * nlxml_binary.cpp for the layout.
+ */
+void save_binary(const FlatNeuronData &data, const std::string &fname);
+
+void save_binary(const NeuronData &data, const std::string &fname);
+
+NeuronData load_binary(const std::string &fname);
+
+// Check if the file is a binary NLXML file written by save_binary
+bool is_binary_file(const std::string &fname);
+
+/* Import the file using the binary sidecar fname + ".bin" as a cache. The
+ * sidecar records the size and modification time of the file it was built
+ * from and is only loaded if they still match, otherwise it's rewritten
+ * after importing the file. The sidecar is replaced by renaming a complete
+ * temporary file over it, so concurrent readers never see a partial one.
+ */
+NeuronData import_cached(const std::string &fname);
+
+// Write data imported from fname as the sidecar import_cached looks for,
+// stamped with fname's current size and modification time
+void save_cache(const FlatNeuronData &data, const std::string &fname);
+
+/* A binary NLXML file mapped into memory. The point arrays are used in
+ * place in the mapping without being copied, while the other tables are
+ * read when the file is opened. Files which are truncated, corrupt or from
+ * a different format version throw a std::runtime_error.
+ */
+class BinaryNeuronFile {
+	MappedFile file;
+	const float *xs, *ys, *zs, *ds;
+	size_t count;
+
+public:
+	// The strings, branches, trees, markers, contours and images in the file.
+	// Its point arrays are left empty, the points are accessed through x()
+	// y(), z() and d() instead
+	FlatNeuronData tables;
+
+	BinaryNeuronFile(const std::string &fname);
+
+	size_t num_points() const;
+	const float* x() const;
+	const float* y() const;
+	const float* z() const;
+	const float* d() const;
+	Point point(size_t i) const;
+
+	// Copy the file out into a FlatNeuronData or NeuronData
+	FlatNeuronData flat() const;
+	NeuronData neuron_data() const;
+};
+
+// How floats are written by the exporters
+enum class FloatFormat {
+	// printf's %.8g, the format tinyxml2 writes
+	COMPATIBLE,
+	// The fewest significant digits which read back as the same float
+	SHORTEST,
+	// Rounded to a fixed number of decimal places, with trailing zeros dropped
+	FIXED
+};
+
+struct ExportOptions {
+	FloatFormat float_format = FloatFormat::COMPATIBLE;
+	// Decimal places kept by FloatFormat::FIXED, from 0 to 9
+	int precision = 3;
+};
+
+/* Write the data as NLXML. The text is streamed out through a fixed size
+ * buffer rather than building a DOM, so memory use doesn't grow with the
+ * size of the data. Failing to open or write the output throws a
+ * std::runtime_error.
+ */
+void export_file(const NeuronData &data, const std::string &fname,
+		const ExportOptions &options = ExportOptions());
+
+void export_stream(const NeuronData &data, std::ostream &os,
+		const ExportOptions &options = ExportOptions());
+
+// Write to an open file descriptor, which is left open
+void export_fd(const NeuronData &data, int fd, const ExportOptions &options = ExportOptions());
+
+/* The samples of an SWC file (http://research.mssm.edu/cnic/swc.html) in
+ * flat arrays, indexed in the order they appear in the file. Parents are
+ * resolved to sample indices, and the children of each sample are listed
+ * in compressed sparse row form sorted by id.
+ */
+struct SWCData {
+	std::vector<int32_t> ids, types, parent_ids;
+	std::vector<float> x, y, z, radius;
+	// The index of each sample's parent, or -1 for samples with parent id -1
+	// or whose parent isn't in the file
+	std::vector<int32_t> parents;
+	// The children of sample i are children[child_offsets[i]] up to
+	// children[child_offsets[i + 1]]
+	std::vector<uint32_t> child_offsets, children;
+	// The samples without a parent, sorted by id
+	std::vector<uint32_t> roots;
+
+	size_t size() const;
+};
+
+/* Read an SWC file in time linear in its size. Blank lines, comments and
+ * any fields past the parent id are skipped. Malformed lines and
+ * duplicate ids throw a std::runtime_error.
+ */
+SWCData read_swc(const std::string &fname);
+
+SWCData read_swc_buffer(const char *data, size_t size);
+
+/* Convert the SWC samples to NLXML trees, one per root sample. Unbranched
+ * runs of samples become the points of a branch, with a child branch
+ * started for each child at a fork. The conversion is iterative, so
+ * arbitrarily deep reconstructions don't overflow the stack.
+ */
+NeuronData convert_swc(const SWCData &swc);
+
+// Import an SWC file as NLXML, reading it with read_swc and converting it
+// with convert_swc. The SWC radii become the NLXML point diameters
+NeuronData import_swc(const std::string &fname);
+
+struct SWCExportOptions {
+	// How the coordinates and radii are written
+	FloatFormat float_format = FloatFormat::SHORTEST;
+	// Decimal places kept by FloatFormat::FIXED, from 0 to 9
+	int precision = 3;
+	// Write the start, fork and end point codes (1, 5 and 6) with 0 for
+	// other points, as older tools expect, instead of the tree's type code
+	bool structure_codes = false;
+	// Written at the top of the file as comment lines if not empty
+	std::string comment;
+};
+
+/* Export the trees as SWC, numbering the samples from 1 in depth first
+ * order with each branch parented to the last point of the branch it comes
+ * off. Samples get the type code of their tree's type and the radius of the
+ * point. Markers, contours and images have no SWC equivalent and are skipped.
+ * Samples are formatted into a reused 1MB buffer written out in blocks.
+ */
+void export_swc(const NeuronData &data, const std::string &fname,
+		const SWCExportOptions &options = SWCExportOptions());
+
+void export_swc_stream(const NeuronData &data, std::ostream &os,
+		const SWCExportOptions &options = SWCExportOptions());
+
+// Write to an open file descriptor, which is left open. Pass STDOUT_FILENO
+// (1) to pipe the SWC to another program
+void export_swc_fd(const NeuronData &data, int fd,
+		const SWCExportOptions &options = SWCExportOptions());
+
+// Write to an open C stdio stream, which is flushed and left open. Pass
+// stdout to pipe the SWC to another program on any platform
+void export_swc_file(const NeuronData &data, std::FILE *file,
+		const SWCExportOptions &options = SWCExportOptions());
+
+/* Writes SWC samples as an NLXML file is parsed, passed to parse_file or
+ * LazyNeuronFile::parse_element. Points are numbered and written as they
+ * arrive, so memory use is bounded by how deeply branches nest instead of
+ * the number of points. The samples are the same as export_swc gives for
+ * the trees, contours and markers are skipped. With structure_codes a
+ * point followed by a single child branch is written as a fork point.
+ */
+class SWCStreamWriter : public ImportHandler {
+	struct State;
+	std::unique_ptr<State> state;
+
+public:
+	SWCStreamWriter(std::ostream &os, const SWCExportOptions &options = SWCExportOptions());
+	// Write to an open file descriptor or C stdio stream, which is left open
+	SWCStreamWriter(int fd, const SWCExportOptions &options = SWCExportOptions());
+	SWCStreamWriter(std::FILE *file, const SWCExportOptions &options = SWCExportOptions());
+	~SWCStreamWriter();
+
+	// Transform the points by the affine matrix, stored column major as
+	// in OpenGL, before they're written. The diameters are kept
+	void set_transform(const float matrix[16]);
+
+	// Write out the buffered samples, this must be called once parsing is done
+	void finish();
+
+	void begin_tree(const Tree &tree) override;
+	void end_tree() override;
+	void begin_branch(const std::string &leaf) override;
+	void end_branch() override;
+	void begin_contour(const Contour &contour) override;
+	void end_contour() override;
+	void begin_marker(const Marker &marker) override;
+	void end_marker() override;
+	void point(const Point &p) override;
+};
+
+/* Apply the affine transform, a 4x4 matrix stored column major as in OpenGL
+ * (e.g. glm::value_ptr), to the points of all trees, branches, contours and
+ * markers. The diameters are kept. Points are transformed in SIMD batches
+ * when the library is built with SSE2 or AVX, with the same result as the
+ * scalar code. The points are split into chunks shared between num_threads
+ * threads, or all hardware threads if 0, the result doesn't depend on the
+ * number of threads.
+ */
+void transform(NeuronData &data, const float matrix[16], size_t num_threads = 1);
+
+void transform(FlatNeuronData &data, const float matrix[16], size_t num_threads = 1);
+
+/* Merge each branch with a single child branch into the child, appending
+ * the child's points, markers and branches to it, so every branch ends in a
+ * fork or a leaf. The branch keeps its own leaf type. The branches directly
+ * on a tree are collapsed but not merged into the tree itself. This takes
+ * time linear in the size of the data, moving the children instead of
+ * copying them.
+ */
+void collapse_degree2(NeuronData &data);
+
+void collapse_degree2(Branch &branch);
+
+struct DecimateOptions {
+	// The furthest the center of a removed point may be from the simplified
+	// line through the points kept, in microns
+	float tolerance = 0.1f;
+	// The most the radius of a removed point may differ from the radius
+	// interpolated along the simplified line, in microns
+	float radius_tolerance = 0.1f;
+	// Decimate the branches on this many threads, or all hardware threads if 0
+	size_t num_threads = 1;
+};
+
+/* Remove points from the trees and branches with 3D Douglas-Peucker
+ * simplification, keeping the fewest points which stay within the
+ * tolerances of the original polyline in both position and radius. The
+ * first and last points of each tree and branch are always kept so branches
+ * stay attached at the forks. Contours and markers are left as they are.
+ * Returns the number of points removed, which doesn't depend on the number
+ * of threads.
+ */
+size_t decimate(NeuronData &data, const DecimateOptions &options = DecimateOptions());
+
+struct MergeOptions {
+	// Points of a tree or branch within this distance, in microns, of an
+	// earlier point of it are merged into that point
+	float distance = 0.01f;
+	// Move the first point of each branch onto the last point of the branch
+	// or tree it comes off if it's within the distance
+	bool snap_branch_starts = false;
+	// Merge the trees on this many threads, or all hardware threads if 0
+	size_t num_threads = 1;
+};
+
+/* Merge the near duplicate points of each tree and branch, such as repeated
+ * samples or a trace crossing back over itself. Points are found through a
+ * uniform hash grid with cells the size of the merge distance, so this runs
+ * in time linear in the number of points. The first and last points of each
+ * tree and branch are kept so branches stay attached at the forks. Returns
+ * the number of points removed, which doesn't depend on the number of
+ * threads.
+ */
+size_t merge_duplicates(NeuronData &data, const MergeOptions &options = MergeOptions());
+
+const uint32_t LOD_VERSION = 1;
+
+/* Save a level of detail pyramid of the data for viewers, each level
+ * decimated from the data with the next tolerance for both position and
+ * radius. The tolerances must be non-negative and increasing, so the first
+ * level is the finest. Forks and branch ends are kept exactly at every
+ * level. Each level is stored as a binary NLXML file in the container, see
+ * nlxml_lod.cpp for the layout.
+ */
+void save_lod(const NeuronData &data, const std::vector<float> &tolerances,
+		const std::string &fname, size_t num_threads = 1);
+
+// Check if the file is an LOD file written by save_lod
+bool is_lod_file(const std::string &fname);
+
+/* An LOD file mapped into memory. Only the level table is read when the
+ * file is opened, each level is read from the mapping when it's copied out
+ * so only the pages of the levels used are loaded. Files which are
+ * truncated, corrupt or from a different format version throw a
+ * std::runtime_error.
+ */
+class LODNeuronFile {
+	struct Level {
+		float tolerance;
+		uint64_t offset, size, num_points;
+	};
+
+	MappedFile file;
+	std::string fname;
+	std::vector<Level> levels;
+
+public:
+	LODNeuronFile(const std::string &fname);
+
+	size_t num_levels() const;
+	// The tolerance the level was decimated with, level 0 is the finest
+	float tolerance(size_t level) const;
+	size_t num_points(size_t level) const;
+
+	// Copy the level out into a FlatNeuronData or NeuronData
+	FlatNeuronData flat(size_t level) const;
+	NeuronData neuron_data(size_t level) const;
+};
+
+struct DiademOptions {
+	// The furthest a test node may be from a gold node in the XY plane and
+	// along Z to match it, in microns
+	float xy_threshold = 1.2f;
+	float z_threshold = 4.f;
+};
+
+struct DiademResult {
+	// The matched share of the gold weight, penalized by the weight of the
+	// extra test nodes: (gold - missed) / (gold + extra), 1 for a perfect match
+	double score = 0;
+	size_t gold_weight = 0;
+	size_t missed_weight = 0;
+	size_t extra_weight = 0;
+	// The gold nodes the test missed and the test nodes matching no gold node,
+	// each point's d is the node's weight
+	std::vector<Point> missed;
+	std::vector<Point> extra;
+};
+
+struct DiademBatchEntry {
+	std::string fname;
+	// Why the file couldn't be imported, empty if it was scored
+	std::string error;
+	DiademResult result;
+};
+
+/* Scores test reconstructions against a gold standard with a DIADEM style
+ * metric. The nodes of each tracing are its roots, forks and terminals,
+ * continuation points aren't counted, each weighted by the number of
+ * terminals below it. Gold nodes are visited from the roots down and each
+ * is matched to the closest unmatched test node within the thresholds
+ * which lies below the test match of the gold node's closest matched
+ * ancestor, so the matches follow the same paths. The gold nodes are found
+ * and indexed once when the scorer is made, after which score can be
+ * called from any number of threads at once.
+ */
+class DiademScorer {
+	struct Gold;
+	std::unique_ptr<Gold> gold;
+
+public:
+	DiademScorer(const NeuronData &gold, const DiademOptions &options = DiademOptions());
+	~DiademScorer();
+
+	DiademResult score(const NeuronData &test) const;
+
+	// Import and score each test file on num_threads threads, or all hardware
+	// threads if 0. A file which fails to import is reported in its entry
+	// rather than stopping the batch. The entries are in the order of the files
+	std::vector<DiademBatchEntry> score_files(const std::vector<std::string> &fnames,
+			size_t num_threads = 1) const;
+};
+
+DiademResult diadem_compare(const NeuronData &gold, const NeuronData &test,
+		const DiademOptions &options = DiademOptions());
+
+// The missed and extra nodes as red squares and blue diamonds in the space
+// of the images, to view over the tracings
+NeuronData diadem_markers(const DiademResult &result, const std::vector<Image> &images);
+
+// Returned by the nearest queries of an empty SpatialIndex
+const size_t NO_INDEX = static_cast<size_t>(-1);
+
+/* A bounding volume hierarchy over the points of the trees and branches,
+ * and over the segments joining consecutive points as capsules with the
+ * radius of the points at their ends. Segments also join the first point of
+ * a branch to the last point of its parent. Points and segments are found
+ * by their index in the flat point arrays, as given by to_flat for a
+ * NeuronData. Each hierarchy is split at the median on its longest axis
+ * down to a few items per leaf, with 32 byte nodes stored depth first so a
+ * node's first child follows it. The top levels are split on one thread and
+ * the subtrees below them built on num_threads threads, or all hardware
+ * threads if 0, giving the same hierarchy for any number of threads.
+ * Queries don't modify the index and can be run from any number of threads
+ * at once. Results listing several items are sorted by index.
+ */
+class SpatialIndex {
+	struct Node {
+		float lo[3], hi[3];
+		// Leaves hold count items starting at first in the item order, inner
+		// nodes have a count of 0 and their second child at first
+		uint32_t first, count;
+	};
+
+	struct Hierarchy {
+		std::vector<Node> nodes;
+		std::vector<uint32_t> items;
+	};
+
+	std::vector<float> xs, ys, zs, ds;
+	std::vector<uint32_t> segment_points;
+	Hierarchy points, segments;
+
+	void build(const std::vector<uint32_t> &point_items, size_t num_threads);
+
+public:
+	SpatialIndex(const NeuronData &data, size_t num_threads = 1);
+	SpatialIndex(const FlatNeuronData &data, size_t num_threads = 1);
+	// Index count points given as flat arrays, with no segments
+	SpatialIndex(const float *x, const float *y, const float *z, const float *d, size_t count,
+			size_t num_threads = 1);
+
+	// The number of points in the arrays, including any not indexed such as
+	// those of contours and markers
+	size_t num_points() const;
+	size_t num_segments() const;
+	Point point(size_t i) const;
+	// The indices of the points at the start and end of the segment
+	size_t segment_start(size_t i) const;
+	size_t segment_end(size_t i) const;
+
+	// Point queries find the indexed points whose centers are closest to p,
+	// within the radius of p or within the box from lo to hi
+	size_t nearest_point(const Point &p) const;
+	std::vector<size_t> points_in_radius(const Point &p, float radius) const;
+	std::vector<size_t> points_in_box(const Point &lo, const Point &hi) const;
+
+	// The distance from p to the surface of the segment's capsule, the radius
+	// is interpolated along the segment and the distance is 0 inside it
+	float segment_distance(size_t i, const Point &p) const;
+	size_t nearest_segment(const Point &p) const;
+	std::vector<size_t> segments_in_radius(const Point &p, float radius) const;
+	// The segments whose capsule's bounding box overlaps the box
+	std::vector<size_t> segments_in_box(const Point &lo, const Point &hi) const;
+};
 
 }
 
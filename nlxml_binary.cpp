@@ -0,0 +1,540 @@
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include "nlxml_binary.h"
+#include "nlxml_writer.h"
+#include "nlxml.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace nlxml {
+
+/* The binary file starts with a fixed size header:
+ *
+ *   char magic[8]         "NLXMLBIN"
+ *   uint32 version        BINARY_VERSION
+ *   uint32 byte_order     0x01020304 as written by the host
+ *   uint64 num_points
+ *   uint64 x, y, z, d     offsets of the point arrays
+ *   uint64 tables         offset of the tables
+ *   uint64 tables_size
+ *   uint64 source_size    size of the file a cache was imported from
+ *   int64 source_mtime    its modification time in seconds
+ *   uint32 source_nsec    and the nanoseconds within the second
+ *   uint32 reserved       0
+ *
+ * followed by the point arrays, each num_points floats starting on an 8
+ * byte boundary so they can be used in place once mapped. The tables hold
+ * the rest of the FlatNeuronData: the interned strings, branches, trees,
+ * markers, contours and images, each as a uint64 count followed by the
+ * fields of each entry. Everything is stored in the host's byte order,
+ * loading a file written with a different one is an error. The source
+ * fields are zero unless the file was written as a cache by import_cached
+ * or save_cache.
+ */
+namespace {
+
+const char MAGIC[8] = {'N', 'L', 'X', 'M', 'L', 'B', 'I', 'N'};
+const uint32_t ENDIAN_CHECK = 0x01020304;
+const size_t HEADER_SIZE = 96;
+
+size_t align8(size_t n) {
+	return (n + 7) & ~size_t(7);
+}
+
+class TableWriter {
+	std::vector<char> &out;
+
+public:
+	TableWriter(std::vector<char> &out) : out(out) {}
+
+	template<typename T>
+	void put(const T &v) {
+		const char *p = reinterpret_cast<const char*>(&v);
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+	void put_bool(bool b) {
+		put(static_cast<uint8_t>(b ? 1 : 0));
+	}
+	void put_count(size_t n) {
+		put(static_cast<uint64_t>(n));
+	}
+	void put_string(const std::string &s) {
+		put(static_cast<uint32_t>(s.size()));
+		out.insert(out.end(), s.begin(), s.end());
+	}
+	void put_color(const Color &c) {
+		put(c.r);
+		put(c.g);
+		put(c.b);
+	}
+};
+
+class TableReader {
+	const char *pos;
+	const char *end;
+
+public:
+	TableReader(const char *begin, const char *end) : pos(begin), end(end) {}
+
+	template<typename T>
+	T get() {
+		T v;
+		check(sizeof(T));
+		std::memcpy(&v, pos, sizeof(T));
+		pos += sizeof(T);
+		return v;
+	}
+	bool get_bool() {
+		return get<uint8_t>() != 0;
+	}
+	// Counts are checked against the bytes left, assuming each entry
+	// takes at least min_size bytes, so a corrupt count can't make us
+	// reserve huge amounts of memory
+	size_t get_count(size_t min_size) {
+		const uint64_t n = get<uint64_t>();
+		if (n > static_cast<uint64_t>(end - pos) / min_size) {
+			corrupt();
+		}
+		return static_cast<size_t>(n);
+	}
+	std::string get_string() {
+		const uint32_t n = get<uint32_t>();
+		check(n);
+		std::string s(pos, n);
+		pos += n;
+		return s;
+	}
+	Color get_color() {
+		Color c;
+		c.r = get<float>();
+		c.g = get<float>();
+		c.b = get<float>();
+		return c;
+	}
+
+	[[noreturn]] static void corrupt() {
+		throw std::runtime_error("Error: binary NLXML file is truncated or corrupt");
+	}
+
+private:
+	void check(size_t n) const {
+		if (static_cast<size_t>(end - pos) < n) {
+			corrupt();
+		}
+	}
+};
+
+void write_tables(const FlatNeuronData &flat, std::vector<char> &out) {
+	TableWriter w(out);
+	w.put_count(flat.strings.size());
+	for (const auto &s : flat.strings) {
+		w.put_string(s);
+	}
+	w.put_count(flat.branches.size());
+	for (const auto &b : flat.branches) {
+		w.put(b.parent);
+		w.put(b.first_point);
+		w.put(b.num_points);
+		w.put(b.leaf);
+	}
+	w.put_count(flat.trees.size());
+	for (const auto &t : flat.trees) {
+		w.put_color(t.color);
+		w.put(t.type);
+		w.put(t.root_branch);
+		w.put(t.num_branches);
+	}
+	w.put_count(flat.markers.size());
+	for (const auto &m : flat.markers) {
+		w.put(m.owner);
+		w.put_bool(m.on_contour);
+		w.put(m.type);
+		w.put(m.name);
+		w.put_color(m.color);
+		w.put_bool(m.varicosity);
+		w.put(m.first_point);
+		w.put(m.num_points);
+	}
+	w.put_count(flat.contours.size());
+	for (const auto &c : flat.contours) {
+		w.put(c.name);
+		w.put(c.shape);
+		w.put_color(c.color);
+		w.put_bool(c.closed);
+		w.put(c.first_point);
+		w.put(c.num_points);
+	}
+	w.put_count(flat.images.size());
+	for (const auto &i : flat.images) {
+		w.put_count(i.filenames.size());
+		for (const auto &f : i.filenames) {
+			w.put_string(f);
+		}
+		w.put(i.scale[0]);
+		w.put(i.scale[1]);
+		w.put(i.coord[0]);
+		w.put(i.coord[1]);
+		w.put(i.coord[2]);
+		w.put(i.z_spacing);
+		w.put(static_cast<uint64_t>(i.slices));
+	}
+}
+
+// Check the tables only refer to strings, points and entries that exist
+void validate_tables(const FlatNeuronData &flat, size_t num_points) {
+	const size_t num_strings = flat.strings.size();
+	auto check_range = [&](uint32_t first, uint32_t count) {
+		if (first > num_points || count > num_points - first) {
+			TableReader::corrupt();
+		}
+	};
+	for (size_t i = 0; i < flat.branches.size(); ++i) {
+		const FlatBranch &b = flat.branches[i];
+		if (b.leaf >= num_strings || b.parent >= static_cast<int64_t>(i) || b.parent < -1) {
+			TableReader::corrupt();
+		}
+		check_range(b.first_point, b.num_points);
+	}
+	for (const auto &t : flat.trees) {
+		if (t.type >= num_strings || t.num_branches == 0 || t.root_branch >= flat.branches.size()
+				|| t.num_branches > flat.branches.size() - t.root_branch) {
+			TableReader::corrupt();
+		}
+	}
+	for (const auto &m : flat.markers) {
+		const size_t owners = m.on_contour ? flat.contours.size() : flat.branches.size();
+		if (m.type >= num_strings || m.name >= num_strings
+				|| m.owner < -1 || (m.owner >= 0 && static_cast<size_t>(m.owner) >= owners)) {
+			TableReader::corrupt();
+		}
+		check_range(m.first_point, m.num_points);
+	}
+	for (const auto &c : flat.contours) {
+		if (c.name >= num_strings || c.shape >= num_strings) {
+			TableReader::corrupt();
+		}
+		check_range(c.first_point, c.num_points);
+	}
+}
+
+void read_tables(const char *begin, const char *end, FlatNeuronData &flat) {
+	TableReader r(begin, end);
+	flat.strings.resize(r.get_count(4));
+	for (auto &s : flat.strings) {
+		s = r.get_string();
+	}
+	flat.branches.resize(r.get_count(16));
+	for (auto &b : flat.branches) {
+		b.parent = r.get<int32_t>();
+		b.first_point = r.get<uint32_t>();
+		b.num_points = r.get<uint32_t>();
+		b.leaf = r.get<uint32_t>();
+	}
+	flat.trees.resize(r.get_count(24));
+	for (auto &t : flat.trees) {
+		t.color = r.get_color();
+		t.type = r.get<uint32_t>();
+		t.root_branch = r.get<uint32_t>();
+		t.num_branches = r.get<uint32_t>();
+	}
+	flat.markers.resize(r.get_count(34));
+	for (auto &m : flat.markers) {
+		m.owner = r.get<int32_t>();
+		m.on_contour = r.get_bool();
+		m.type = r.get<uint32_t>();
+		m.name = r.get<uint32_t>();
+		m.color = r.get_color();
+		m.varicosity = r.get_bool();
+		m.first_point = r.get<uint32_t>();
+		m.num_points = r.get<uint32_t>();
+	}
+	flat.contours.resize(r.get_count(29));
+	for (auto &c : flat.contours) {
+		c.name = r.get<uint32_t>();
+		c.shape = r.get<uint32_t>();
+		c.color = r.get_color();
+		c.closed = r.get_bool();
+		c.first_point = r.get<uint32_t>();
+		c.num_points = r.get<uint32_t>();
+	}
+	flat.images.resize(r.get_count(40));
+	for (auto &i : flat.images) {
+		i.filenames.resize(r.get_count(4));
+		for (auto &f : i.filenames) {
+			f = r.get_string();
+		}
+		i.scale[0] = r.get<float>();
+		i.scale[1] = r.get<float>();
+		i.coord[0] = r.get<float>();
+		i.coord[1] = r.get<float>();
+		i.coord[2] = r.get<float>();
+		i.z_spacing = r.get<float>();
+		i.slices = static_cast<size_t>(r.get<uint64_t>());
+	}
+}
+
+bool has_magic(const char *data, size_t size) {
+	return size >= sizeof(MAGIC) && std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// The size and modification time of the file, with the sub-second part where stat has it
+bool file_stamp(const std::string &fname, detail::SourceStamp &stamp) {
+	struct stat st;
+	if (stat(fname.c_str(), &st) != 0) {
+		return false;
+	}
+	stamp.size = static_cast<uint64_t>(st.st_size);
+	stamp.mtime_sec = static_cast<int64_t>(st.st_mtime);
+#if defined(__APPLE__)
+	stamp.mtime_nsec = static_cast<uint32_t>(st.st_mtimespec.tv_nsec);
+#elif defined(_WIN32)
+	stamp.mtime_nsec = 0;
+#else
+	stamp.mtime_nsec = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+#endif
+	return true;
+}
+
+bool older(const detail::SourceStamp &a, const detail::SourceStamp &b) {
+	return a.mtime_sec < b.mtime_sec || (a.mtime_sec == b.mtime_sec && a.mtime_nsec < b.mtime_nsec);
+}
+
+void write_file(const FlatNeuronData &data, const std::string &fname, const detail::SourceStamp &source) {
+	std::ofstream fout(fname.c_str(), std::ios::binary);
+	if (!fout) {
+		throw std::runtime_error("Error: failed to open " + fname + " for writing");
+	}
+	detail::OutputBuffer out(fout);
+	detail::write_binary(data, out, source);
+	out.flush();
+	fout.close();
+	if (!fout) {
+		throw std::runtime_error("Error: failed to write " + fname);
+	}
+}
+
+/* Write the cache to a temporary file next to it and rename it into place,
+ * so other processes reading or mapping the cache see either the old file
+ * or the complete new one, never a partly written or truncated one.
+ */
+void write_cache(const FlatNeuronData &data, const std::string &cache, const detail::SourceStamp &source) {
+	std::random_device rd;
+	const std::string tmp = cache + ".tmp" + std::to_string(rd());
+	try {
+		write_file(data, tmp, source);
+	} catch (const std::runtime_error &) {
+		std::remove(tmp.c_str());
+		throw;
+	}
+	if (std::rename(tmp.c_str(), cache.c_str()) != 0) {
+		// Windows won't rename over an existing file
+		std::remove(cache.c_str());
+		if (std::rename(tmp.c_str(), cache.c_str()) != 0) {
+			std::remove(tmp.c_str());
+			throw std::runtime_error("Error: failed to write " + cache);
+		}
+	}
+}
+
+}
+
+namespace detail {
+
+uint64_t write_binary(const FlatNeuronData &data, OutputBuffer &out, const SourceStamp &source) {
+	const size_t n = data.num_points();
+	if (data.y.size() != n || data.z.size() != n || data.d.size() != n) {
+		throw std::runtime_error("Error: the point arrays of the data to save differ in size");
+	}
+	std::vector<char> tables;
+	write_tables(data, tables);
+
+	uint64_t offsets[6];
+	size_t pos = HEADER_SIZE;
+	for (size_t i = 0; i < 4; ++i) {
+		offsets[i] = pos;
+		pos = align8(pos + n * sizeof(float));
+	}
+	offsets[4] = pos;
+	offsets[5] = tables.size();
+
+	out.write(MAGIC, sizeof(MAGIC));
+	const uint32_t version = BINARY_VERSION;
+	out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char*>(&ENDIAN_CHECK), sizeof(ENDIAN_CHECK));
+	const uint64_t num_points = n;
+	out.write(reinterpret_cast<const char*>(&num_points), sizeof(num_points));
+	out.write(reinterpret_cast<const char*>(offsets), sizeof(offsets));
+	out.write(reinterpret_cast<const char*>(&source.size), sizeof(source.size));
+	out.write(reinterpret_cast<const char*>(&source.mtime_sec), sizeof(source.mtime_sec));
+	out.write(reinterpret_cast<const char*>(&source.mtime_nsec), sizeof(source.mtime_nsec));
+	const uint32_t reserved = 0;
+	out.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+
+	const std::vector<float> *arrays[] = {&data.x, &data.y, &data.z, &data.d};
+	const char padding[8] = {0};
+	for (const auto &a : arrays) {
+		out.write(reinterpret_cast<const char*>(a->data()), n * sizeof(float));
+		out.write(padding, align8(n * sizeof(float)) - n * sizeof(float));
+	}
+	out.write(tables.data(), tables.size());
+	return offsets[4] + offsets[5];
+}
+
+BinaryPoints read_binary(const char *data, size_t size, const std::string &name, FlatNeuronData &tables) {
+	if (size < HEADER_SIZE || !has_magic(data, size)) {
+		throw std::runtime_error("Error: " + name + " is not a binary NLXML file");
+	}
+	TableReader header(data + sizeof(MAGIC), data + HEADER_SIZE);
+	const uint32_t version = header.get<uint32_t>();
+	if (header.get<uint32_t>() != ENDIAN_CHECK) {
+		throw std::runtime_error("Error: binary NLXML file " + name
+				+ " was written on a machine with a different byte order");
+	}
+	if (version != BINARY_VERSION) {
+		throw std::runtime_error("Error: binary NLXML file " + name + " has version "
+				+ std::to_string(version) + ", expected " + std::to_string(BINARY_VERSION));
+	}
+	const uint64_t num_points = header.get<uint64_t>();
+	if (num_points > size / sizeof(float)) {
+		TableReader::corrupt();
+	}
+	BinaryPoints points;
+	points.count = static_cast<size_t>(num_points);
+	const float **arrays[] = {&points.x, &points.y, &points.z, &points.d};
+	for (auto &a : arrays) {
+		const uint64_t offset = header.get<uint64_t>();
+		if (offset % 8 != 0 || offset > size || points.count * sizeof(float) > size - offset) {
+			TableReader::corrupt();
+		}
+		*a = reinterpret_cast<const float*>(data + offset);
+	}
+	const uint64_t tables_offset = header.get<uint64_t>();
+	const uint64_t tables_size = header.get<uint64_t>();
+	points.source.size = header.get<uint64_t>();
+	points.source.mtime_sec = header.get<int64_t>();
+	points.source.mtime_nsec = header.get<uint32_t>();
+	if (tables_offset > size || tables_size > size - tables_offset) {
+		TableReader::corrupt();
+	}
+	read_tables(data + tables_offset, data + tables_offset + tables_size, tables);
+	validate_tables(tables, points.count);
+	return points;
+}
+
+}
+
+void save_binary(const FlatNeuronData &data, const std::string &fname) {
+	write_file(data, fname, detail::SourceStamp());
+}
+void save_binary(const NeuronData &data, const std::string &fname) {
+	save_binary(to_flat(data), fname);
+}
+
+NeuronData load_binary(const std::string &fname) {
+	return BinaryNeuronFile(fname).neuron_data();
+}
+
+bool is_binary_file(const std::string &fname) {
+	std::ifstream fin(fname.c_str(), std::ios::binary);
+	char magic[sizeof(MAGIC)];
+	return fin.read(magic, sizeof(magic)) && has_magic(magic, sizeof(magic));
+}
+
+void save_cache(const FlatNeuronData &data, const std::string &fname) {
+	detail::SourceStamp source;
+	if (!file_stamp(fname, source)) {
+		throw std::runtime_error("Error: file " + fname + " does not exist, or is unreadable");
+	}
+	write_cache(data, fname + ".bin", source);
+}
+
+NeuronData import_cached(const std::string &fname) {
+	if (is_binary_file(fname)) {
+		return load_binary(fname);
+	}
+	// Stamp the file before importing it, if it changes while we read it
+	// the cache won't match it and will be rebuilt the next time
+	const std::string cache = fname + ".bin";
+	detail::SourceStamp source, cache_stamp;
+	const bool have_source = file_stamp(fname, source);
+	if (have_source && file_stamp(cache, cache_stamp)) {
+		try {
+			const MappedFile file(cache);
+			FlatNeuronData flat;
+			const detail::BinaryPoints points = detail::read_binary(file.data(), file.size(), cache, flat);
+			/* The file may have been rewritten within the resolution of the
+			 * modification times after the cache was built from it, keeping
+			 * the same size and time. A cache written no later than the file
+			 * was modified could be from before such a change, so it's only
+			 * trusted once it's strictly newer than the file.
+			 */
+			if (points.source == source && older(source, cache_stamp)) {
+				flat.x.assign(points.x, points.x + points.count);
+				flat.y.assign(points.y, points.y + points.count);
+				flat.z.assign(points.z, points.z + points.count);
+				flat.d.assign(points.d, points.d + points.count);
+				return from_flat(flat);
+			}
+		} catch (const std::runtime_error &) {
+			// Fall through and rebuild a corrupt cache
+		}
+	}
+	const FlatNeuronData flat = import_file_flat(fname);
+	if (have_source) {
+		try {
+			write_cache(flat, cache, source);
+		} catch (const std::runtime_error &) {
+			// The cache is only an optimization, e.g. the directory may be read-only
+		}
+	}
+	return from_flat(flat);
+}
+
+BinaryNeuronFile::BinaryNeuronFile(const std::string &fname) : file(fname), xs(nullptr),
+	ys(nullptr), zs(nullptr), ds(nullptr), count(0)
+{
+	const detail::BinaryPoints points = detail::read_binary(file.data(), file.size(), fname, tables);
+	xs = points.x;
+	ys = points.y;
+	zs = points.z;
+	ds = points.d;
+	count = points.count;
+}
+size_t BinaryNeuronFile::num_points() const {
+	return count;
+}
+const float* BinaryNeuronFile::x() const {
+	return xs;
+}
+const float* BinaryNeuronFile::y() const {
+	return ys;
+}
+const float* BinaryNeuronFile::z() const {
+	return zs;
+}
+const float* BinaryNeuronFile::d() const {
+	return ds;
+}
+Point BinaryNeuronFile::point(size_t i) const {
+	return Point(xs[i], ys[i], zs[i], ds[i]);
+}
+FlatNeuronData BinaryNeuronFile::flat() const {
+	FlatNeuronData f = tables;
+	f.x.assign(xs, xs + count);
+	f.y.assign(ys, ys + count);
+	f.z.assign(zs, zs + count);
+	f.d.assign(ds, ds + count);
+	return f;
+}
+NeuronData BinaryNeuronFile::neuron_data() const {
+	return from_flat(flat());
+}
+
+}
+
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "nlxml_writer.h"
+#include "nlxml.h"
+
+// Internal helpers for the binary format, not installed with the library
+namespace nlxml {
+namespace detail {
+
+// The size and modification time of the file a binary cache was imported
+// from, all zero for files not written as a cache
+struct SourceStamp {
+	uint64_t size;
+	int64_t mtime_sec;
+	uint32_t mtime_nsec;
+
+	SourceStamp() : size(0), mtime_sec(0), mtime_nsec(0) {}
+
+	bool operator==(const SourceStamp &s) const {
+		return size == s.size && mtime_sec == s.mtime_sec && mtime_nsec == s.mtime_nsec;
+	}
+};
+
+// Write the data in the save_binary layout, returning the number of bytes written
+uint64_t write_binary(const FlatNeuronData &data, OutputBuffer &out,
+		const SourceStamp &source = SourceStamp());
+
+// The point arrays of a binary NLXML file in memory
+struct BinaryPoints {
+	const float *x, *y, *z, *d;
+	size_t count;
+	SourceStamp source;
+};
+
+/* Check the header of the save_binary layout at data and read its tables,
+ * returning where its point arrays are. Throws a std::runtime_error naming
+ * name if it's not a binary NLXML file or it's truncated or corrupt.
+ */
+BinaryPoints read_binary(const char *data, size_t size, const std::string &name, FlatNeuronData &tables);
+
+}
+}
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "nlxml_parallel.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+namespace {
+
+const uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+
+struct Node {
+	Point p;
+	uint32_t parent;
+	// One past the last node below this one, the nodes are numbered in
+	// preorder so the nodes below are the ones in [index + 1, end)
+	uint32_t end;
+	size_t weight;
+};
+
+struct Line {
+	const std::vector<Point> *points;
+	const std::vector<Branch> *branches;
+	uint32_t parent;
+};
+
+/* Find the roots, forks and terminals of the trees in preorder. The end of
+ * a tree or branch is a fork if it has more than one child and a terminal
+ * if it has none, the end of a branch with a single child is a continuation
+ * of it and isn't a node. Each node is weighted by the terminals below it.
+ */
+std::vector<Node> find_nodes(const NeuronData &data) {
+	std::vector<Node> nodes;
+	auto add_node = [&](const Point &p, uint32_t parent, bool terminal) {
+		nodes.push_back(Node{p, parent, 0, terminal ? size_t(1) : size_t(0)});
+		return static_cast<uint32_t>(nodes.size() - 1);
+	};
+	std::vector<Line> stack;
+	for (const auto &t : data.trees) {
+		uint32_t root = NO_NODE;
+		if (!t.points.empty()) {
+			root = add_node(t.points.front(), NO_NODE, t.points.size() == 1 && t.branches.empty());
+		}
+		// A tree with a single point is just its root
+		stack.push_back(Line{t.points.size() > 1 ? &t.points : nullptr, &t.branches, root});
+		while (!stack.empty()) {
+			const Line l = stack.back();
+			stack.pop_back();
+			uint32_t parent = l.parent;
+			if (l.points && !l.points->empty() && l.branches->size() != 1) {
+				parent = add_node(l.points->back(), parent, l.branches->empty());
+			}
+			for (auto b = l.branches->rbegin(); b != l.branches->rend(); ++b) {
+				stack.push_back(Line{&b->points, &b->branches, parent});
+			}
+		}
+	}
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		nodes[i].end = static_cast<uint32_t>(i + 1);
+	}
+	for (size_t i = nodes.size(); i-- > 0;) {
+		const uint32_t p = nodes[i].parent;
+		if (p != NO_NODE) {
+			nodes[p].weight += nodes[i].weight;
+			nodes[p].end = std::max(nodes[p].end, nodes[i].end);
+		}
+	}
+	return nodes;
+}
+
+struct Candidate {
+	uint32_t gold;
+	uint32_t test;
+	float dist2;
+
+	bool operator<(const Candidate &c) const {
+		if (gold != c.gold) {
+			return gold < c.gold;
+		}
+		if (dist2 != c.dist2) {
+			return dist2 < c.dist2;
+		}
+		return test < c.test;
+	}
+};
+
+Point weighted(const Node &n) {
+	Point p = n.p;
+	p.d = static_cast<float>(n.weight);
+	return p;
+}
+
+// Index the positions of the nodes
+SpatialIndex index_nodes(const std::vector<Node> &nodes) {
+	std::vector<float> x, y, z, d;
+	for (const auto &n : nodes) {
+		x.push_back(n.p.x);
+		y.push_back(n.p.y);
+		z.push_back(n.p.z);
+		d.push_back(n.p.d);
+	}
+	return SpatialIndex(x.data(), y.data(), z.data(), d.data(), nodes.size());
+}
+
+}
+
+struct DiademScorer::Gold {
+	DiademOptions options;
+	std::vector<Node> nodes;
+	SpatialIndex index;
+
+	Gold(const NeuronData &data, const DiademOptions &options)
+		: options(options), nodes(find_nodes(data)), index(index_nodes(nodes))
+	{}
+};
+
+DiademScorer::DiademScorer(const NeuronData &data, const DiademOptions &options) {
+	if (!(options.xy_threshold >= 0) || !(options.z_threshold >= 0)) {
+		throw std::runtime_error("Error: DIADEM thresholds must not be negative");
+	}
+	gold.reset(new Gold(data, options));
+}
+
+DiademScorer::~DiademScorer() {}
+
+DiademResult DiademScorer::score(const NeuronData &data) const {
+	const std::vector<Node> &gold_nodes = gold->nodes;
+	const std::vector<Node> test_nodes = find_nodes(data);
+	const float xy = gold->options.xy_threshold;
+	const float z = gold->options.z_threshold;
+
+	// Find the gold nodes within the thresholds of each test node
+	std::vector<Candidate> candidates;
+	for (size_t t = 0; t < test_nodes.size(); ++t) {
+		const Point &p = test_nodes[t].p;
+		const Point lo(p.x - xy, p.y - xy, p.z - z);
+		const Point hi(p.x + xy, p.y + xy, p.z + z);
+		for (const size_t g : gold->index.points_in_box(lo, hi)) {
+			const Point &q = gold_nodes[g].p;
+			const float dx = q.x - p.x;
+			const float dy = q.y - p.y;
+			const float dz = q.z - p.z;
+			if (dx * dx + dy * dy <= xy * xy) {
+				candidates.push_back(Candidate{static_cast<uint32_t>(g), static_cast<uint32_t>(t),
+						dx * dx + dy * dy + dz * dz});
+			}
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	// Match the gold nodes from the roots down. scope is the test match of
+	// the closest matched gold node at or above each gold node, the match of
+	// a gold node must be below the scope of its parent
+	std::vector<uint32_t> scope(gold_nodes.size(), NO_NODE);
+	std::vector<char> used(test_nodes.size(), 0);
+	DiademResult result;
+	auto c = candidates.begin();
+	for (uint32_t g = 0; g < gold_nodes.size(); ++g) {
+		const Node &n = gold_nodes[g];
+		const uint32_t parent_scope = n.parent == NO_NODE ? NO_NODE : scope[n.parent];
+		uint32_t match = NO_NODE;
+		for (; c != candidates.end() && c->gold == g; ++c) {
+			const bool below = parent_scope == NO_NODE
+				|| (c->test > parent_scope && c->test < test_nodes[parent_scope].end);
+			if (match == NO_NODE && !used[c->test] && below) {
+				match = c->test;
+				used[match] = 1;
+			}
+		}
+		scope[g] = match != NO_NODE ? match : parent_scope;
+		result.gold_weight += n.weight;
+		if (match == NO_NODE) {
+			result.missed_weight += n.weight;
+			result.missed.push_back(weighted(n));
+		}
+	}
+	for (size_t t = 0; t < test_nodes.size(); ++t) {
+		if (!used[t]) {
+			result.extra_weight += test_nodes[t].weight;
+			result.extra.push_back(weighted(test_nodes[t]));
+		}
+	}
+	const size_t total = result.gold_weight + result.extra_weight;
+	result.score = total == 0 ? 1.0
+		: double(result.gold_weight - result.missed_weight) / double(total);
+	return result;
+}
+
+std::vector<DiademBatchEntry> DiademScorer::score_files(const std::vector<std::string> &fnames,
+		size_t num_threads) const
+{
+	std::vector<DiademBatchEntry> entries(fnames.size());
+	detail::parallel_for(fnames.size(), num_threads, [&](size_t i) {
+		entries[i].fname = fnames[i];
+		NeuronData test;
+		try {
+			test = import_file(fnames[i]);
+		} catch (const std::exception &e) {
+			entries[i].error = e.what();
+			return;
+		}
+		entries[i].result = score(test);
+	});
+	return entries;
+}
+
+DiademResult diadem_compare(const NeuronData &gold, const NeuronData &test, const DiademOptions &options) {
+	return DiademScorer(gold, options).score(test);
+}
+
+NeuronData diadem_markers(const DiademResult &result, const std::vector<Image> &images) {
+	NeuronData markers;
+	markers.images = images;
+	if (!result.missed.empty()) {
+		markers.markers.push_back(Marker{"FilledSquare", "missed pts", Color{1.0, 0.0, 0.0},
+				false, result.missed});
+	}
+	if (!result.extra.empty()) {
+		markers.markers.push_back(Marker{"FilledDiamond", "extra pts", Color{0.0, 0.0, 1.0},
+				false, result.extra});
+	}
+	return markers;
+}
+
+}
@@ -0,0 +1,409 @@
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "nlxml_parallel.h"
+#include "nlxml_reader.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+using namespace detail;
+
+size_t FlatNeuronData::num_points() const {
+	return x.size();
+}
+Point FlatNeuronData::point(size_t i) const {
+	return Point(x[i], y[i], z[i], d[i]);
+}
+
+namespace {
+
+class StringTable {
+	std::vector<std::string> &strings;
+	std::unordered_map<std::string, uint32_t> ids;
+
+public:
+	StringTable(std::vector<std::string> &strings) : strings(strings) {
+		for (size_t i = 0; i < strings.size(); ++i) {
+			ids.emplace(strings[i], static_cast<uint32_t>(i));
+		}
+	}
+	uint32_t intern(const std::string &s) {
+		auto fnd = ids.find(s);
+		if (fnd != ids.end()) {
+			return fnd->second;
+		}
+		const uint32_t id = static_cast<uint32_t>(strings.size());
+		strings.push_back(s);
+		ids.emplace(s, id);
+		return id;
+	}
+};
+
+/* Builds the FlatNeuronData from the elements streamed in by the parser.
+ * The points of a top-level element are staged as they come in, tagged
+ * with the branch, marker or contour they belong to, and written out grouped
+ * by owner once the element ends. This keeps each range contiguous even
+ * when markers and child branches are interleaved with a branch's points.
+ */
+class FlatBuilder : public ImportHandler {
+	enum SegmentKind { BRANCH, MARKER, CONTOUR };
+	struct Segment {
+		SegmentKind kind;
+		uint32_t index;
+	};
+
+	FlatNeuronData &flat;
+	StringTable strings;
+	// Points of the current top-level element and the segment they belong to
+	std::vector<Point> staged;
+	std::vector<uint32_t> staged_segment;
+	std::vector<Segment> segments;
+	// The innermost segment is the one points are currently added to
+	std::vector<uint32_t> open_segments;
+	std::vector<uint32_t> open_branches;
+	bool in_contour = false;
+
+public:
+	FlatBuilder(FlatNeuronData &flat) : flat(flat), strings(flat.strings) {}
+
+	void begin_tree(const Tree &t) override {
+		FlatTree ft;
+		ft.color = t.color;
+		ft.type = strings.intern(t.type);
+		ft.root_branch = static_cast<uint32_t>(flat.branches.size());
+		ft.num_branches = 0;
+		flat.trees.push_back(ft);
+		push_branch(-1, t.leaf);
+	}
+	void end_tree() override {
+		open_branches.pop_back();
+		open_segments.pop_back();
+		FlatTree &ft = flat.trees.back();
+		ft.num_branches = static_cast<uint32_t>(flat.branches.size()) - ft.root_branch;
+		flush();
+	}
+	void begin_branch(const std::string &leaf) override {
+		push_branch(static_cast<int32_t>(open_branches.back()), leaf);
+	}
+	void end_branch() override {
+		open_branches.pop_back();
+		open_segments.pop_back();
+	}
+	void begin_contour(const Contour &c) override {
+		FlatContour fc;
+		fc.name = strings.intern(c.name);
+		fc.shape = strings.intern(c.shape);
+		fc.color = c.color;
+		fc.closed = c.closed;
+		fc.first_point = fc.num_points = 0;
+		flat.contours.push_back(fc);
+		push_segment(CONTOUR, flat.contours.size() - 1);
+		in_contour = true;
+	}
+	void end_contour() override {
+		open_segments.pop_back();
+		in_contour = false;
+		flush();
+	}
+	void begin_marker(const Marker &m) override {
+		FlatMarker fm;
+		if (in_contour) {
+			fm.owner = static_cast<int32_t>(flat.contours.size() - 1);
+		} else if (!open_branches.empty()) {
+			fm.owner = static_cast<int32_t>(open_branches.back());
+		} else {
+			fm.owner = -1;
+		}
+		fm.on_contour = in_contour;
+		fm.type = strings.intern(m.type);
+		fm.name = strings.intern(m.name);
+		fm.color = m.color;
+		fm.varicosity = m.varicosity;
+		fm.first_point = fm.num_points = 0;
+		flat.markers.push_back(fm);
+		push_segment(MARKER, flat.markers.size() - 1);
+	}
+	void end_marker() override {
+		open_segments.pop_back();
+		if (open_segments.empty()) {
+			flush();
+		}
+	}
+	void point(const Point &p) override {
+		staged.push_back(p);
+		staged_segment.push_back(open_segments.back());
+	}
+	void image(const Image &i) override {
+		flat.images.push_back(i);
+	}
+
+private:
+	void push_branch(int32_t parent, const std::string &leaf) {
+		FlatBranch b;
+		b.parent = parent;
+		b.first_point = b.num_points = 0;
+		b.leaf = strings.intern(leaf);
+		flat.branches.push_back(b);
+		open_branches.push_back(static_cast<uint32_t>(flat.branches.size() - 1));
+		push_segment(BRANCH, flat.branches.size() - 1);
+	}
+	void push_segment(SegmentKind kind, size_t index) {
+		open_segments.push_back(static_cast<uint32_t>(segments.size()));
+		segments.push_back(Segment{kind, static_cast<uint32_t>(index)});
+	}
+	// Write the staged points out grouped by segment with a counting sort
+	void flush() {
+		std::vector<uint32_t> offsets(segments.size() + 1, 0);
+		for (const auto &s : staged_segment) {
+			++offsets[s + 1];
+		}
+		const size_t base = flat.x.size();
+		for (size_t i = 0; i < segments.size(); ++i) {
+			uint32_t *first = nullptr, *count = nullptr;
+			switch (segments[i].kind) {
+				case BRANCH:
+					first = &flat.branches[segments[i].index].first_point;
+					count = &flat.branches[segments[i].index].num_points;
+					break;
+				case MARKER:
+					first = &flat.markers[segments[i].index].first_point;
+					count = &flat.markers[segments[i].index].num_points;
+					break;
+				case CONTOUR:
+					first = &flat.contours[segments[i].index].first_point;
+					count = &flat.contours[segments[i].index].num_points;
+					break;
+			}
+			*count = offsets[i + 1];
+			offsets[i + 1] += offsets[i];
+			*first = static_cast<uint32_t>(base + offsets[i]);
+		}
+
+		const size_t n = base + staged.size();
+		flat.x.resize(n);
+		flat.y.resize(n);
+		flat.z.resize(n);
+		flat.d.resize(n);
+		for (size_t i = 0; i < staged.size(); ++i) {
+			const size_t j = base + offsets[staged_segment[i]]++;
+			flat.x[j] = staged[i].x;
+			flat.y[j] = staged[i].y;
+			flat.z[j] = staged[i].z;
+			flat.d[j] = staged[i].d;
+		}
+		staged.clear();
+		staged_segment.clear();
+		segments.clear();
+	}
+};
+
+// Pass the NeuronData through the handler in the order export_file writes it
+void stream_points(const std::vector<Point> &points, ImportHandler &handler) {
+	for (const auto &p : points) {
+		handler.point(p);
+	}
+}
+void stream_markers(const std::vector<Marker> &markers, ImportHandler &handler) {
+	for (const auto &m : markers) {
+		handler.begin_marker(m);
+		stream_points(m.points, handler);
+		handler.end_marker();
+	}
+}
+void stream_branch(const Branch &b, ImportHandler &handler) {
+	handler.begin_branch(b.leaf);
+	stream_points(b.points, handler);
+	for (const auto &c : b.branches) {
+		stream_branch(c, handler);
+	}
+	stream_markers(b.markers, handler);
+	handler.end_branch();
+}
+void stream_neuron_data(const NeuronData &data, ImportHandler &handler) {
+	for (const auto &i : data.images) {
+		handler.image(i);
+	}
+	for (const auto &t : data.trees) {
+		handler.begin_tree(t);
+		stream_points(t.points, handler);
+		for (const auto &b : t.branches) {
+			stream_branch(b, handler);
+		}
+		stream_markers(t.markers, handler);
+		handler.end_tree();
+	}
+	for (const auto &c : data.contours) {
+		handler.begin_contour(c);
+		stream_points(c.points, handler);
+		stream_markers(c.markers, handler);
+		handler.end_contour();
+	}
+	stream_markers(data.markers, handler);
+}
+
+// Append src onto dst, remapping its string and table indices
+void append_flat(FlatNeuronData &dst, StringTable &strings, const FlatNeuronData &src) {
+	std::vector<uint32_t> remap(src.strings.size());
+	for (size_t i = 0; i < src.strings.size(); ++i) {
+		remap[i] = strings.intern(src.strings[i]);
+	}
+	const uint32_t point_base = static_cast<uint32_t>(dst.x.size());
+	const int32_t branch_base = static_cast<int32_t>(dst.branches.size());
+	const int32_t contour_base = static_cast<int32_t>(dst.contours.size());
+
+	dst.x.insert(dst.x.end(), src.x.begin(), src.x.end());
+	dst.y.insert(dst.y.end(), src.y.begin(), src.y.end());
+	dst.z.insert(dst.z.end(), src.z.begin(), src.z.end());
+	dst.d.insert(dst.d.end(), src.d.begin(), src.d.end());
+	for (FlatBranch b : src.branches) {
+		b.parent = b.parent == -1 ? -1 : b.parent + branch_base;
+		b.first_point += point_base;
+		b.leaf = remap[b.leaf];
+		dst.branches.push_back(b);
+	}
+	for (FlatTree t : src.trees) {
+		t.type = remap[t.type];
+		t.root_branch += branch_base;
+		dst.trees.push_back(t);
+	}
+	for (FlatMarker m : src.markers) {
+		if (m.owner != -1) {
+			m.owner += m.on_contour ? contour_base : branch_base;
+		}
+		m.type = remap[m.type];
+		m.name = remap[m.name];
+		m.first_point += point_base;
+		dst.markers.push_back(m);
+	}
+	for (FlatContour c : src.contours) {
+		c.name = remap[c.name];
+		c.shape = remap[c.shape];
+		c.first_point += point_base;
+		dst.contours.push_back(c);
+	}
+	dst.images.insert(dst.images.end(), src.images.begin(), src.images.end());
+}
+
+std::vector<Point> read_points(const FlatNeuronData &flat, uint32_t first, uint32_t count) {
+	std::vector<Point> points;
+	points.reserve(count);
+	for (uint32_t i = first; i < first + count; ++i) {
+		points.push_back(flat.point(i));
+	}
+	return points;
+}
+Marker read_marker(const FlatNeuronData &flat, const FlatMarker &fm) {
+	Marker m;
+	m.type = flat.strings[fm.type];
+	m.name = flat.strings[fm.name];
+	m.color = fm.color;
+	m.varicosity = fm.varicosity;
+	m.points = read_points(flat, fm.first_point, fm.num_points);
+	return m;
+}
+
+}
+
+FlatNeuronData to_flat(const NeuronData &data) {
+	FlatNeuronData flat;
+	FlatBuilder builder(flat);
+	stream_neuron_data(data, builder);
+	return flat;
+}
+NeuronData from_flat(const FlatNeuronData &flat) {
+	NeuronData data;
+	data.images = flat.images;
+
+	std::vector<Branch> branches(flat.branches.size());
+	for (size_t i = 0; i < flat.branches.size(); ++i) {
+		const FlatBranch &fb = flat.branches[i];
+		branches[i].leaf = flat.strings[fb.leaf];
+		branches[i].points = read_points(flat, fb.first_point, fb.num_points);
+	}
+	data.contours.reserve(flat.contours.size());
+	for (const auto &fc : flat.contours) {
+		Contour c;
+		c.name = flat.strings[fc.name];
+		c.shape = flat.strings[fc.shape];
+		c.color = fc.color;
+		c.closed = fc.closed;
+		c.points = read_points(flat, fc.first_point, fc.num_points);
+		data.contours.push_back(std::move(c));
+	}
+	for (const auto &fm : flat.markers) {
+		if (fm.owner == -1) {
+			data.markers.push_back(read_marker(flat, fm));
+		} else if (fm.on_contour) {
+			data.contours.at(fm.owner).markers.push_back(read_marker(flat, fm));
+		} else {
+			branches.at(fm.owner).markers.push_back(read_marker(flat, fm));
+		}
+	}
+
+	// Branches are stored depth-first with parents before their children, so
+	// moving them into their parents from the back finishes each subtree before
+	// it's moved. The children are collected in reverse and flipped once done
+	data.trees.reserve(flat.trees.size());
+	for (const auto &ft : flat.trees) {
+		const uint32_t root = ft.root_branch;
+		for (uint32_t i = root + ft.num_branches; i-- > root + 1;) {
+			std::reverse(branches[i].branches.begin(), branches[i].branches.end());
+			const int32_t parent = flat.branches[i].parent;
+			if (parent < static_cast<int32_t>(root) || parent >= static_cast<int32_t>(i)) {
+				throw std::runtime_error("Error: flat branch " + std::to_string(i)
+						+ " has an invalid parent");
+			}
+			branches[parent].branches.push_back(std::move(branches[i]));
+		}
+		std::reverse(branches[root].branches.begin(), branches[root].branches.end());
+
+		Tree t;
+		t.color = ft.color;
+		t.type = flat.strings[ft.type];
+		t.leaf = std::move(branches[root].leaf);
+		t.points = std::move(branches[root].points);
+		t.branches = std::move(branches[root].branches);
+		t.markers = std::move(branches[root].markers);
+		data.trees.push_back(std::move(t));
+	}
+	return data;
+}
+
+FlatNeuronData import_buffer_flat(const char *data, size_t size, const ImportOptions &user_options) {
+	FlatNeuronData flat;
+	if (user_options.num_threads == 1) {
+		FlatBuilder builder(flat);
+		parse_buffer(data, size, builder, user_options);
+		return flat;
+	}
+
+	std::vector<ElementInfo> elements = scan_elements(data, size);
+	const ImportOptions options = resolve_transform(data, size, user_options, &elements);
+	elements.erase(std::remove_if(elements.begin(), elements.end(),
+				[&](const ElementInfo &e) { return !selected(e, options); }),
+			elements.end());
+
+	std::vector<FlatNeuronData> parsed(elements.size());
+	parallel_for(elements.size(), options.num_threads,
+		[&](const size_t i) {
+			FlatBuilder builder(parsed[i]);
+			parse_element(data, elements[i], builder, options);
+		});
+
+	StringTable strings(flat.strings);
+	for (const auto &p : parsed) {
+		append_flat(flat, strings, p);
+	}
+	return flat;
+}
+FlatNeuronData import_file_flat(const std::string &fname, const ImportOptions &options) {
+	const MappedFile file(fname);
+	return import_buffer_flat(file.data(), file.size(), options);
+}
+
+}
+
@@ -0,0 +1,190 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include "nlxml_binary.h"
+#include "nlxml_writer.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+/* The LOD file starts with a fixed size header:
+ *
+ *   char magic[8]         "NLXMLLOD"
+ *   uint32 version        LOD_VERSION
+ *   uint32 byte_order     0x01020304 as written by the host
+ *   uint32 num_levels
+ *   uint32 reserved       0
+ *
+ * followed by the level table, one entry per level from the finest:
+ *
+ *   float tolerance
+ *   uint32 reserved       0
+ *   uint64 offset         of the level's data in the file
+ *   uint64 size           of the level's data
+ *   uint64 num_points
+ *
+ * Each level's data is a complete binary NLXML file as written by
+ * save_binary, starting on an 8 byte boundary, so its point arrays can be
+ * used in place and only the pages of the levels read are touched.
+ */
+namespace {
+
+const char LOD_MAGIC[8] = {'N', 'L', 'X', 'M', 'L', 'L', 'O', 'D'};
+const uint32_t ENDIAN_CHECK = 0x01020304;
+const size_t HEADER_SIZE = 24;
+const size_t LEVEL_SIZE = 32;
+
+uint64_t align8(uint64_t n) {
+	return (n + 7) & ~uint64_t(7);
+}
+
+[[noreturn]] void corrupt(const std::string &fname) {
+	throw std::runtime_error("Error: LOD NLXML file " + fname + " is truncated or corrupt");
+}
+
+template<typename T>
+T read(const char *p) {
+	T v;
+	std::memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+template<typename T>
+void write(char *p, const T &v) {
+	std::memcpy(p, &v, sizeof(T));
+}
+
+}
+
+void save_lod(const NeuronData &data, const std::vector<float> &tolerances,
+		const std::string &fname, size_t num_threads)
+{
+	if (tolerances.empty()) {
+		throw std::runtime_error("Error: an LOD file needs at least one level");
+	}
+	for (size_t i = 0; i < tolerances.size(); ++i) {
+		if (!(tolerances[i] >= 0) || (i > 0 && tolerances[i] < tolerances[i - 1])) {
+			throw std::runtime_error("Error: LOD tolerances must be non-negative and increasing");
+		}
+	}
+	std::ofstream fout(fname.c_str(), std::ios::binary);
+	if (!fout) {
+		throw std::runtime_error("Error: failed to open " + fname + " for writing");
+	}
+
+	// The level table is filled in once the levels are written
+	std::vector<char> header(HEADER_SIZE + tolerances.size() * LEVEL_SIZE, 0);
+	std::memcpy(header.data(), LOD_MAGIC, sizeof(LOD_MAGIC));
+	write(&header[8], LOD_VERSION);
+	write(&header[12], ENDIAN_CHECK);
+	write(&header[16], static_cast<uint32_t>(tolerances.size()));
+
+	detail::OutputBuffer out(fout);
+	out.write(header.data(), header.size());
+	uint64_t pos = header.size();
+	const char padding[8] = {0};
+	for (size_t i = 0; i < tolerances.size(); ++i) {
+		// Each level is decimated from the original so its error doesn't
+		// build up through the coarser levels. The first and last points of
+		// each branch are kept, so the forks stay exactly where they are
+		NeuronData level = data;
+		DecimateOptions options;
+		options.tolerance = tolerances[i];
+		options.radius_tolerance = tolerances[i];
+		options.num_threads = num_threads;
+		decimate(level, options);
+		const FlatNeuronData flat = to_flat(level);
+
+		out.write(padding, align8(pos) - pos);
+		pos = align8(pos);
+		const uint64_t size = detail::write_binary(flat, out);
+
+		char *entry = &header[HEADER_SIZE + i * LEVEL_SIZE];
+		write(entry, tolerances[i]);
+		write(entry + 8, pos);
+		write(entry + 16, size);
+		write(entry + 24, static_cast<uint64_t>(flat.num_points()));
+		pos += size;
+	}
+	out.flush();
+	fout.seekp(0);
+	fout.write(header.data(), header.size());
+	fout.close();
+	if (!fout) {
+		throw std::runtime_error("Error: failed to write " + fname);
+	}
+}
+
+bool is_lod_file(const std::string &fname) {
+	std::ifstream fin(fname.c_str(), std::ios::binary);
+	char magic[sizeof(LOD_MAGIC)];
+	return fin.read(magic, sizeof(magic)) && std::memcmp(magic, LOD_MAGIC, sizeof(magic)) == 0;
+}
+
+LODNeuronFile::LODNeuronFile(const std::string &fname) : file(fname), fname(fname) {
+	const char *data = file.data();
+	const size_t size = file.size();
+	if (size < HEADER_SIZE || std::memcmp(data, LOD_MAGIC, sizeof(LOD_MAGIC)) != 0) {
+		throw std::runtime_error("Error: " + fname + " is not an LOD NLXML file");
+	}
+	if (read<uint32_t>(data + 12) != ENDIAN_CHECK) {
+		throw std::runtime_error("Error: LOD NLXML file " + fname
+				+ " was written on a machine with a different byte order");
+	}
+	const uint32_t version = read<uint32_t>(data + 8);
+	if (version != LOD_VERSION) {
+		throw std::runtime_error("Error: LOD NLXML file " + fname + " has version "
+				+ std::to_string(version) + ", expected " + std::to_string(LOD_VERSION));
+	}
+	const uint32_t num_levels = read<uint32_t>(data + 16);
+	if (num_levels > (size - HEADER_SIZE) / LEVEL_SIZE) {
+		corrupt(fname);
+	}
+	for (size_t i = 0; i < num_levels; ++i) {
+		const char *entry = data + HEADER_SIZE + i * LEVEL_SIZE;
+		Level l;
+		l.tolerance = read<float>(entry);
+		l.offset = read<uint64_t>(entry + 8);
+		l.size = read<uint64_t>(entry + 16);
+		l.num_points = read<uint64_t>(entry + 24);
+		if (l.offset % 8 != 0 || l.offset > size || l.size > size - l.offset) {
+			corrupt(fname);
+		}
+		levels.push_back(l);
+	}
+}
+
+size_t LODNeuronFile::num_levels() const {
+	return levels.size();
+}
+
+float LODNeuronFile::tolerance(size_t level) const {
+	return levels.at(level).tolerance;
+}
+
+size_t LODNeuronFile::num_points(size_t level) const {
+	return levels.at(level).num_points;
+}
+
+FlatNeuronData LODNeuronFile::flat(size_t level) const {
+	const Level &l = levels.at(level);
+	FlatNeuronData flat;
+	const detail::BinaryPoints points = detail::read_binary(file.data() + l.offset,
+			l.size, fname, flat);
+	if (points.count != l.num_points) {
+		corrupt(fname);
+	}
+	flat.x.assign(points.x, points.x + points.count);
+	flat.y.assign(points.y, points.y + points.count);
+	flat.z.assign(points.z, points.z + points.count);
+	flat.d.assign(points.d, points.d + points.count);
+	return flat;
+}
+
+NeuronData LODNeuronFile::neuron_data(size_t level) const {
+	return from_flat(flat(level));
+}
+
+}
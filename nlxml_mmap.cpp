@@ -0,0 +1,116 @@
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include "nlxml.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace nlxml {
+
+MappedFile::MappedFile() : ptr(nullptr), len(0), file(nullptr), mapping(nullptr) {}
+MappedFile::MappedFile(const std::string &fname) : MappedFile() {
+	const std::string err = "Error: file " + fname + " does not exist, or is unreadable";
+#ifdef _WIN32
+	HANDLE fh = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fh == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error(err);
+	}
+	file = fh;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(fh, &file_size)) {
+		close();
+		throw std::runtime_error(err);
+	}
+	len = static_cast<size_t>(file_size.QuadPart);
+	// Empty files can't be mapped, but are valid to open
+	if (len == 0) {
+		return;
+	}
+	mapping = CreateFileMappingA(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		close();
+		throw std::runtime_error(err);
+	}
+	ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!ptr) {
+		close();
+		throw std::runtime_error(err);
+	}
+#else
+	const int fd = open(fname.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error(err);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		::close(fd);
+		throw std::runtime_error(err);
+	}
+	len = static_cast<size_t>(st.st_size);
+	if (len != 0) {
+		void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			::close(fd);
+			throw std::runtime_error(err);
+		}
+		ptr = static_cast<const char*>(m);
+	}
+	// The mapping stays valid after the file is closed
+	::close(fd);
+#endif
+}
+MappedFile::MappedFile(MappedFile &&m) : MappedFile() {
+	*this = std::move(m);
+}
+MappedFile& MappedFile::operator=(MappedFile &&m) {
+	if (this != &m) {
+		close();
+		std::swap(ptr, m.ptr);
+		std::swap(len, m.len);
+		std::swap(file, m.file);
+		std::swap(mapping, m.mapping);
+	}
+	return *this;
+}
+MappedFile::~MappedFile() {
+	close();
+}
+const char* MappedFile::data() const {
+	return ptr;
+}
+size_t MappedFile::size() const {
+	return len;
+}
+void MappedFile::close() {
+#ifdef _WIN32
+	if (ptr) {
+		UnmapViewOfFile(ptr);
+	}
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	if (file) {
+		CloseHandle(file);
+	}
+#else
+	if (ptr) {
+		munmap(const_cast<char*>(ptr), len);
+	}
+#endif
+	ptr = nullptr;
+	len = 0;
+	file = nullptr;
+	mapping = nullptr;
+}
+
+}
+
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Internal threading helpers, not installed with the library
+namespace nlxml {
+namespace detail {
+
+// Resolve a user thread count, where 0 means use all hardware threads
+inline size_t resolve_threads(size_t num_threads) {
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+	return num_threads == 0 ? 1 : num_threads;
+}
+
+/* Call f(i) for each i in [0, count) on up to num_threads threads, which
+ * take the next index as they finish. Indices are handed out in order so
+ * callers wanting the largest work first should sort it up front. The
+ * first exception thrown by f is rethrown once all threads have finished.
+ */
+template<typename F>
+void parallel_for(size_t count, size_t num_threads, const F &f) {
+	num_threads = std::min(resolve_threads(num_threads), count);
+	if (num_threads <= 1) {
+		for (size_t i = 0; i < count; ++i) {
+			f(i);
+		}
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			try {
+				f(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				// Stop handing out more work
+				next = count;
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto &t : threads) {
+		t.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+}
+}
+
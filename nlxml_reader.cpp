@@ -0,0 +1,515 @@
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include "tinyxml2.h"
+#include "nlxml_reader.h"
+
+namespace nlxml {
+namespace detail {
+
+static bool is_space(const char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+static bool is_name_end(const char c) {
+	return is_space(c) || c == '/' || c == '>' || c == '=';
+}
+
+StrRef::StrRef(const char *begin, const char *end) : begin(begin), end(end) {}
+size_t StrRef::size() const {
+	return end - begin;
+}
+bool StrRef::empty() const {
+	return begin == end;
+}
+std::string StrRef::str() const {
+	return std::string(begin, end);
+}
+bool StrRef::operator==(const char *s) const {
+	const size_t len = std::strlen(s);
+	return size() == len && std::memcmp(begin, s, len) == 0;
+}
+bool StrRef::operator!=(const char *s) const {
+	return !(*this == s);
+}
+
+XMLReader::XMLReader(const char *begin, const char *end)
+	: begin(begin), end(end), pos(begin), token_start(begin), tok(END_DOCUMENT),
+	cdata(false), pending_end(false)
+{
+	// Skip the UTF-8 BOM if there is one
+	if (end - pos >= 3 && std::memcmp(pos, "\xEF\xBB\xBF", 3) == 0) {
+		pos += 3;
+	}
+}
+XMLReader::Token XMLReader::next() {
+	if (pending_end) {
+		pending_end = false;
+		open_elements.pop_back();
+		tok = END_ELEMENT;
+		return END_ELEMENT;
+	}
+	cdata = false;
+	while (true) {
+		token_start = pos;
+		if (pos == end) {
+			if (!open_elements.empty()) {
+				error("unexpected end of document in <" + open_elements.back().str() + ">");
+			}
+			tok = END_DOCUMENT;
+			return END_DOCUMENT;
+		}
+		if (*pos != '<') {
+			const char *lt = static_cast<const char*>(std::memchr(pos, '<', end - pos));
+			tok_text = StrRef(pos, lt ? lt : end);
+			pos = tok_text.end;
+			tok = TEXT;
+			return TEXT;
+		}
+
+		const size_t remaining = end - pos;
+		if (remaining >= 4 && std::memcmp(pos, "<!--", 4) == 0) {
+			pos = find(pos + 4, "-->", 3) + 3;
+		} else if (remaining >= 9 && std::memcmp(pos, "<![CDATA[", 9) == 0) {
+			const char *text_end = find(pos + 9, "]]>", 3);
+			tok_text = StrRef(pos + 9, text_end);
+			pos = text_end + 3;
+			cdata = true;
+			tok = TEXT;
+			return TEXT;
+		} else if (remaining >= 2 && pos[1] == '?') {
+			pos = find(pos + 2, "?>", 2) + 2;
+		} else if (remaining >= 2 && pos[1] == '!') {
+			pos = find(pos + 2, ">", 1) + 1;
+		} else if (remaining >= 2 && pos[1] == '/') {
+			read_end_tag();
+			return END_ELEMENT;
+		} else {
+			read_start_tag();
+			return START_ELEMENT;
+		}
+	}
+}
+bool XMLReader::next_child() {
+	while (true) {
+		switch (next()) {
+			case START_ELEMENT: return true;
+			case END_ELEMENT: return false;
+			case END_DOCUMENT: return false;
+			default: break;
+		}
+	}
+}
+size_t XMLReader::skip_element(const char *count_name) {
+	if (pending_end) {
+		next();
+		return 0;
+	}
+	// Only the nesting depth is tracked while skipping, so the content skipped
+	// isn't checked for mismatched tags or read into attributes
+	cdata = false;
+	size_t skip_depth = 1;
+	size_t count = 0;
+	const size_t count_len = count_name ? std::strlen(count_name) : 0;
+	const char *p = pos;
+	while (true) {
+		p = static_cast<const char*>(std::memchr(p, '<', end - p));
+		if (!p) {
+			pos = end;
+			error("unexpected end of document in <" + open_elements.back().str() + ">");
+		}
+		const size_t remaining = end - p;
+		if (remaining >= 4 && std::memcmp(p, "<!--", 4) == 0) {
+			p = find(p + 4, "-->", 3) + 3;
+		} else if (remaining >= 9 && std::memcmp(p, "<![CDATA[", 9) == 0) {
+			p = find(p + 9, "]]>", 3) + 3;
+		} else if (remaining >= 2 && p[1] == '?') {
+			p = find(p + 2, "?>", 2) + 2;
+		} else if (remaining >= 2 && p[1] == '!') {
+			p = find(p + 2, ">", 1) + 1;
+		} else if (remaining >= 2 && p[1] == '/') {
+			if (--skip_depth == 0) {
+				break;
+			}
+			p = find(p + 2, ">", 1) + 1;
+		} else {
+			if (count_name && remaining > count_len + 1 && std::memcmp(p + 1, count_name, count_len) == 0
+					&& is_name_end(p[count_len + 1]))
+			{
+				++count;
+			}
+			// Find the end of the start tag, any '>' in quoted attribute values
+			// doesn't close it
+			char quote = 0;
+			++p;
+			for (; p != end; ++p) {
+				if (quote) {
+					quote = *p == quote ? 0 : quote;
+				} else if (*p == '"' || *p == '\'') {
+					quote = *p;
+				} else if (*p == '>') {
+					break;
+				}
+			}
+			if (p == end) {
+				pos = end;
+				error("unexpected end of document in <" + open_elements.back().str() + ">");
+			}
+			if (p[-1] != '/') {
+				++skip_depth;
+			}
+			++p;
+		}
+	}
+	pos = p;
+	token_start = p;
+	read_end_tag();
+	return count;
+}
+XMLReader::Token XMLReader::token() const {
+	return static_cast<Token>(tok);
+}
+StrRef XMLReader::name() const {
+	return tok_name;
+}
+StrRef XMLReader::text() const {
+	return tok_text;
+}
+bool XMLReader::is_cdata() const {
+	return cdata;
+}
+const std::vector<XMLAttrib>& XMLReader::attributes() const {
+	return attribs;
+}
+const XMLAttrib* XMLReader::find_attribute(const char *name) const {
+	for (const auto &a : attribs) {
+		if (a.name == name) {
+			return &a;
+		}
+	}
+	return nullptr;
+}
+size_t XMLReader::depth() const {
+	return open_elements.size();
+}
+const char* XMLReader::token_begin() const {
+	return token_start;
+}
+const char* XMLReader::position() const {
+	return pos;
+}
+void XMLReader::read_start_tag() {
+	const char *p = pos + 1;
+	const char *name_start = p;
+	while (p != end && !is_name_end(*p)) {
+		++p;
+	}
+	if (p == name_start) {
+		pos = p;
+		error("expected an element name");
+	}
+	tok_name = StrRef(name_start, p);
+	attribs.clear();
+	while (true) {
+		while (p != end && is_space(*p)) {
+			++p;
+		}
+		if (p == end) {
+			pos = p;
+			error("unterminated <" + tok_name.str() + "> tag");
+		}
+		if (*p == '>') {
+			++p;
+			break;
+		}
+		if (*p == '/') {
+			if (p + 1 == end || p[1] != '>') {
+				pos = p;
+				error("expected '>' after '/' in <" + tok_name.str() + "> tag");
+			}
+			p += 2;
+			pending_end = true;
+			break;
+		}
+
+		XMLAttrib a;
+		a.needs_decode = false;
+		const char *attrib_start = p;
+		while (p != end && !is_name_end(*p)) {
+			++p;
+		}
+		a.name = StrRef(attrib_start, p);
+		while (p != end && is_space(*p)) {
+			++p;
+		}
+		if (a.name.empty() || p == end || *p != '=') {
+			pos = p;
+			error("malformed attribute in <" + tok_name.str() + "> tag");
+		}
+		++p;
+		while (p != end && is_space(*p)) {
+			++p;
+		}
+		if (p == end || (*p != '"' && *p != '\'')) {
+			pos = p;
+			error("expected a quoted value for attribute " + a.name.str());
+		}
+		const char quote = *p++;
+		const char *value_start = p;
+		while (p != end && *p != quote) {
+			a.needs_decode |= *p == '&' || *p == '\r';
+			++p;
+		}
+		if (p == end) {
+			pos = p;
+			error("unterminated value for attribute " + a.name.str());
+		}
+		a.value = StrRef(value_start, p);
+		++p;
+		attribs.push_back(a);
+	}
+	pos = p;
+	open_elements.push_back(tok_name);
+	tok = START_ELEMENT;
+}
+void XMLReader::read_end_tag() {
+	const char *p = pos + 2;
+	const char *name_start = p;
+	while (p != end && !is_name_end(*p)) {
+		++p;
+	}
+	tok_name = StrRef(name_start, p);
+	while (p != end && is_space(*p)) {
+		++p;
+	}
+	if (p == end || *p != '>') {
+		pos = p;
+		error("unterminated </" + tok_name.str() + "> tag");
+	}
+	pos = p + 1;
+	if (open_elements.empty() || open_elements.back().size() != tok_name.size()
+			|| std::memcmp(open_elements.back().begin, tok_name.begin, tok_name.size()) != 0)
+	{
+		error("mismatched end tag </" + tok_name.str() + ">");
+	}
+	open_elements.pop_back();
+	tok = END_ELEMENT;
+}
+const char* XMLReader::find(const char *from, const char *str, size_t len) const {
+	for (const char *p = from; static_cast<size_t>(end - p) >= len; ++p) {
+		p = static_cast<const char*>(std::memchr(p, str[0], end - p));
+		if (!p || static_cast<size_t>(end - p) < len) {
+			break;
+		}
+		if (std::memcmp(p, str, len) == 0) {
+			return p;
+		}
+	}
+	error("unterminated markup, expected '" + std::string(str, len) + "'");
+}
+void XMLReader::error(const std::string &msg) const {
+	throw std::runtime_error("Error: malformed XML at byte " + std::to_string(pos - begin) + ": " + msg);
+}
+
+static void append_utf8(std::string &out, unsigned long c) {
+	if (c < 0x80) {
+		out.push_back(static_cast<char>(c));
+	} else if (c < 0x800) {
+		out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+		out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	} else if (c < 0x10000) {
+		out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+		out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	} else if (c < 0x200000) {
+		out.push_back(static_cast<char>(0xF0 | (c >> 18)));
+		out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	}
+}
+// Try to decode the character reference (&#N; or &#xN;) starting at p, returns
+// the position following it or nullptr if it's not a valid reference
+static const char* decode_char_ref(const char *p, const char *end, std::string &out) {
+	const char *semi = static_cast<const char*>(std::memchr(p, ';', end - p));
+	if (!semi) {
+		return nullptr;
+	}
+	const bool hex = p + 2 < semi && (p[2] == 'x' || p[2] == 'X');
+	const char *digits = p + (hex ? 3 : 2);
+	if (digits == semi) {
+		return nullptr;
+	}
+	unsigned long c = 0;
+	for (const char *d = digits; d != semi; ++d) {
+		unsigned long v = 0;
+		if (*d >= '0' && *d <= '9') {
+			v = *d - '0';
+		} else if (hex && *d >= 'a' && *d <= 'f') {
+			v = *d - 'a' + 10;
+		} else if (hex && *d >= 'A' && *d <= 'F') {
+			v = *d - 'A' + 10;
+		} else {
+			return nullptr;
+		}
+		c = c * (hex ? 16 : 10) + v;
+		if (c > 0x10FFFF) {
+			return nullptr;
+		}
+	}
+	append_utf8(out, c);
+	return semi + 1;
+}
+std::string decode(const StrRef &str, bool needs_decode) {
+	if (!needs_decode) {
+		return str.str();
+	}
+	static const struct {
+		const char *pattern;
+		size_t length;
+		char value;
+	} entities[] = {
+		{"&quot;", 6, '"'}, {"&amp;", 5, '&'}, {"&apos;", 6, '\''}, {"&lt;", 4, '<'}, {"&gt;", 4, '>'}
+	};
+	std::string out;
+	out.reserve(str.size());
+	const char *p = str.begin;
+	while (p != str.end) {
+		if (*p == '\r') {
+			// Normalize CR LF and lone CR to LF
+			out.push_back('\n');
+			p += (p + 1 != str.end && p[1] == '\n') ? 2 : 1;
+		} else if (*p == '\n') {
+			// tinyxml2 also collapses LF CR to LF
+			out.push_back('\n');
+			p += (p + 1 != str.end && p[1] == '\r') ? 2 : 1;
+		} else if (*p == '&') {
+			const char *next = nullptr;
+			if (p + 1 != str.end && p[1] == '#') {
+				next = decode_char_ref(p, str.end, out);
+			} else {
+				for (const auto &e : entities) {
+					if (static_cast<size_t>(str.end - p) >= e.length
+							&& std::memcmp(p, e.pattern, e.length) == 0)
+					{
+						out.push_back(e.value);
+						next = p + e.length;
+						break;
+					}
+				}
+			}
+			if (next) {
+				p = next;
+			} else {
+				// Unrecognized references are kept as is
+				out.push_back(*p++);
+			}
+		} else {
+			out.push_back(*p++);
+		}
+	}
+	return out;
+}
+
+// Convert the decimal number m * 10^e exactly, returns false if it can't
+// be rounded correctly with double arithmetic
+static bool exact_decimal_to_float(uint64_t m, int e, bool negative, float *value) {
+	// Every power of ten up to 1e22 is exactly representable as a double
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	if (m == 0) {
+		*value = negative ? -0.f : 0.f;
+		return true;
+	}
+	if (m > (uint64_t(1) << 53) || e < -22 || e > 22) {
+		return false;
+	}
+	// With both operands exact the result is the correctly rounded double
+	double d = static_cast<double>(m);
+	d = e < 0 ? d / pow10[-e] : d * pow10[e];
+	if (d > FLT_MAX || d < FLT_MIN) {
+		return false;
+	}
+	// Rounding to double and then to float only differs from rounding the exact
+	// value straight to float when the double lands exactly halfway between two
+	// floats. For normal floats that's when the 29 mantissa bits dropped are 100..0
+	uint64_t bits;
+	std::memcpy(&bits, &d, sizeof(bits));
+	if ((bits & 0x1FFFFFFF) == 0x10000000) {
+		return false;
+	}
+	const float f = static_cast<float>(d);
+	*value = negative ? -f : f;
+	return true;
+}
+bool parse_float(const char *begin, const char *end, float *value) {
+	const char *p = begin;
+	while (p != end && (is_space(*p) || *p == '\v' || *p == '\f')) {
+		++p;
+	}
+	bool negative = false;
+	if (p != end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+	uint64_t m = 0;
+	int digits = 0;
+	int e = 0;
+	bool any_digits = false;
+	for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+		any_digits = true;
+		if (m != 0 || *p != '0') {
+			m = m * 10 + (*p - '0');
+			++digits;
+		}
+	}
+	if (p != end && *p == '.') {
+		for (++p; p != end && *p >= '0' && *p <= '9'; ++p) {
+			any_digits = true;
+			if (m != 0 || *p != '0') {
+				m = m * 10 + (*p - '0');
+				++digits;
+			}
+			--e;
+		}
+	}
+	if (any_digits && p != end && (*p == 'e' || *p == 'E')) {
+		const char *exp_start = p++;
+		bool exp_negative = false;
+		if (p != end && (*p == '-' || *p == '+')) {
+			exp_negative = *p == '-';
+			++p;
+		}
+		int exp = 0;
+		bool exp_digits = false;
+		for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+			exp_digits = true;
+			exp = std::min(exp * 10 + (*p - '0'), 100000);
+		}
+		if (exp_digits) {
+			e += exp_negative ? -exp : exp;
+		} else {
+			p = exp_start;
+		}
+	}
+	// More than 19 significant digits may have overflowed the mantissa
+	if (any_digits && p == end && digits <= 19 && exact_decimal_to_float(m, e, negative, value)) {
+		return true;
+	}
+
+	char buf[64];
+	const size_t len = end - begin;
+	if (len < sizeof(buf)) {
+		std::memcpy(buf, begin, len);
+		buf[len] = '\0';
+		return tinyxml2::XMLUtil::ToFloat(buf, value);
+	}
+	return tinyxml2::XMLUtil::ToFloat(std::string(begin, end).c_str(), value);
+}
+
+}
+}
+
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "nlxml.h"
+
+// Internal helpers shared by the importers, not installed with the library
+namespace nlxml {
+
+Color parse_color(const std::string &str);
+
+namespace detail {
+
+// A reference to a range of characters in the document being read
+struct StrRef {
+	const char *begin;
+	const char *end;
+
+	StrRef(const char *begin = nullptr, const char *end = nullptr);
+	size_t size() const;
+	bool empty() const;
+	std::string str() const;
+	bool operator==(const char *s) const;
+	bool operator!=(const char *s) const;
+};
+
+struct XMLAttrib {
+	StrRef name, value;
+	// Set if the value contains entity or character references or carriage
+	// returns, and must be passed through decode before use
+	bool needs_decode;
+};
+
+/* A forward-only tokenizer over an XML document held in memory. Unlike
+ * tinyxml2 it doesn't build a DOM or copy the document: names, attributes
+ * and text are returned as references into the buffer, which doesn't need
+ * to be null terminated. Comments, declarations and DTDs are skipped.
+ * Malformed documents throw a std::runtime_error.
+ */
+class XMLReader {
+	const char *begin, *end, *pos;
+	// Start of the most recently read token
+	const char *token_start;
+	int tok;
+	StrRef tok_name, tok_text;
+	bool cdata;
+	// Set when the last start tag was self-closing, the next call to next
+	// will return its end tag
+	bool pending_end;
+	std::vector<XMLAttrib> attribs;
+	std::vector<StrRef> open_elements;
+
+public:
+	enum Token { START_ELEMENT, END_ELEMENT, TEXT, END_DOCUMENT };
+
+	XMLReader(const char *begin, const char *end);
+
+	// Read the next token in the document
+	Token next();
+	// Read up to the next child element of the innermost open element, returns
+	// false once the end tag of that element has been read instead
+	bool next_child();
+	// Skip the rest of the innermost open element, including all its children.
+	// After a START_ELEMENT this skips the element that was just started.
+	// Returns the number of elements named count_name which were skipped over
+	size_t skip_element(const char *count_name = nullptr);
+
+	Token token() const;
+	// The element name for START_ELEMENT and END_ELEMENT tokens
+	StrRef name() const;
+	// The raw text for TEXT tokens
+	StrRef text() const;
+	// Set if the TEXT token is the contents of a CDATA section
+	bool is_cdata() const;
+	// The attributes of the element started by the last START_ELEMENT
+	const std::vector<XMLAttrib>& attributes() const;
+	const XMLAttrib* find_attribute(const char *name) const;
+	// The number of currently open elements
+	size_t depth() const;
+	// The start of the most recently read token
+	const char* token_begin() const;
+	// The position following the most recently read token
+	const char* position() const;
+
+private:
+	void read_start_tag();
+	void read_end_tag();
+	// Find the next occurrence of str at or after from, or throw if there isn't one
+	const char* find(const char *from, const char *str, size_t len) const;
+	[[noreturn]] void error(const std::string &msg) const;
+};
+
+// Replace entity and character references and normalize newlines as tinyxml2 does
+std::string decode(const StrRef &str, bool needs_decode);
+
+/* Parse a float from the string, giving bit-identical results to the
+ * sscanf("%f") used by tinyxml2::XMLUtil::ToFloat in the "C" locale.
+ * Plain decimal numbers, which is all NLXML files contain, are converted
+ * exactly without sscanf or the locale. Anything else (hex floats, inf,
+ * nan, trailing text or numbers the fast path can't round correctly)
+ * falls back to sscanf. Returns false and leaves value unchanged if no
+ * number could be read, as ToFloat does.
+ */
+bool parse_float(const char *begin, const char *end, float *value);
+
+// Defined in nlxml_stream.cpp
+
+// Index the top-level trees, contours, markers and images of the document
+// without parsing them
+std::vector<ElementInfo> scan_elements(const char *data, size_t size);
+
+// Stream a top-level element found by scan_elements through the handler
+void parse_element(const char *data, const ElementInfo &e, ImportHandler &handler,
+		const ImportOptions &options);
+
+// Check if the element is selected for import by the options
+bool selected(const ElementInfo &e, const ImportOptions &options);
+
+/* Fold the options' image transform into their matrix, giving options with
+ * the matrix to apply to each point and image_transform NONE. The image is
+ * found through the element index if there is one, or by stepping over the
+ * top-level elements of the document until the images are reached.
+ */
+ImportOptions resolve_transform(const char *data, size_t size, const ImportOptions &options,
+		const std::vector<ElementInfo> *elements = nullptr);
+
+// Fold the image transform of the first of the images into the options' matrix
+ImportOptions resolve_transform(const std::vector<Image> &images, const ImportOptions &options);
+
+}
+}
+
@@ -0,0 +1,300 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "nlxml_parallel.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+namespace {
+
+// Merge the chain of only children below the branch into it
+void collapse_chain(Branch &b) {
+	while (b.branches.size() == 1) {
+		Branch child = std::move(b.branches[0]);
+		if (b.points.empty()) {
+			b.points = std::move(child.points);
+		} else {
+			b.points.insert(b.points.end(), child.points.begin(), child.points.end());
+		}
+		if (b.markers.empty()) {
+			b.markers = std::move(child.markers);
+		} else {
+			b.markers.insert(b.markers.end(), std::make_move_iterator(child.markers.begin()),
+					std::make_move_iterator(child.markers.end()));
+		}
+		b.branches = std::move(child.branches);
+	}
+}
+
+// The error of a point relative to the tolerance, values over 1 exceed it
+double relative_error(double error, double tolerance) {
+	if (tolerance > 0) {
+		return error / tolerance;
+	}
+	return error > 0 ? std::numeric_limits<double>::infinity() : 0;
+}
+
+// How far p is outside the tolerances of the segment from a to b
+double segment_error(const Point &p, const Point &a, const Point &b, const DecimateOptions &options) {
+	const double v[3] = {double(b.x) - a.x, double(b.y) - a.y, double(b.z) - a.z};
+	const double w[3] = {double(p.x) - a.x, double(p.y) - a.y, double(p.z) - a.z};
+	const double len2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	double t = 0;
+	if (len2 > 0) {
+		t = (w[0] * v[0] + w[1] * v[1] + w[2] * v[2]) / len2;
+		t = std::min(std::max(t, 0.0), 1.0);
+	}
+	double dist2 = 0;
+	for (size_t i = 0; i < 3; ++i) {
+		const double e = w[i] - t * v[i];
+		dist2 += e * e;
+	}
+	const double radius = (double(a.d) + t * (double(b.d) - a.d)) / 2;
+	const double radius_error = std::abs(p.d / 2.0 - radius);
+	return std::max(relative_error(std::sqrt(dist2), options.tolerance),
+			relative_error(radius_error, options.radius_tolerance));
+}
+
+// Douglas-Peucker simplify the polyline in place, returning the number of
+// points removed
+size_t decimate_points(std::vector<Point> &points, const DecimateOptions &options) {
+	const size_t n = points.size();
+	if (n < 3) {
+		return 0;
+	}
+	std::vector<char> keep(n, 0);
+	keep[0] = 1;
+	keep[n - 1] = 1;
+	std::vector<std::pair<size_t, size_t>> stack(1, std::make_pair(size_t(0), n - 1));
+	while (!stack.empty()) {
+		const auto span = stack.back();
+		stack.pop_back();
+		double max_error = 1;
+		size_t split = span.first;
+		for (size_t i = span.first + 1; i < span.second; ++i) {
+			const double e = segment_error(points[i], points[span.first], points[span.second], options);
+			if (e > max_error) {
+				max_error = e;
+				split = i;
+			}
+		}
+		if (split != span.first) {
+			keep[split] = 1;
+			stack.push_back(std::make_pair(span.first, split));
+			stack.push_back(std::make_pair(split, span.second));
+		}
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (keep[i]) {
+			points[kept++] = points[i];
+		}
+	}
+	points.resize(kept);
+	return n - kept;
+}
+
+const uint32_t NO_POINT = std::numeric_limits<uint32_t>::max();
+
+/* A uniform grid over the points of one line, hashing each cell to a list
+ * of the points in it. The cells are the size of the merge distance, so any
+ * point within the distance of another is in one of the 27 cells around it.
+ */
+class PointGrid {
+	struct Cell {
+		int64_t x, y, z;
+	};
+	float cell_size;
+	std::vector<Cell> cells;
+	// The first point in each hash slot, or NO_POINT
+	std::vector<uint32_t> heads;
+	// The next point in the same slot as each point
+	std::vector<uint32_t> next;
+	const std::vector<Point> *points;
+
+	Cell cell(const Point &p) const {
+		return Cell{int64_t(std::floor(p.x / cell_size)), int64_t(std::floor(p.y / cell_size)),
+			int64_t(std::floor(p.z / cell_size))};
+	}
+	size_t slot(const Cell &c) const {
+		const uint64_t h = uint64_t(c.x) * 73856093u ^ uint64_t(c.y) * 19349663u ^ uint64_t(c.z) * 83492791u;
+		return h & (heads.size() - 1);
+	}
+
+public:
+	PointGrid(float distance) : cell_size(distance > 0 ? distance : 1.f), points(nullptr) {}
+
+	void reset(const std::vector<Point> &line) {
+		points = &line;
+		size_t size = 16;
+		while (size < 2 * line.size()) {
+			size *= 2;
+		}
+		heads.assign(size, NO_POINT);
+		next.resize(line.size());
+		cells.resize(line.size());
+	}
+	void insert(uint32_t i) {
+		cells[i] = cell((*points)[i]);
+		const size_t s = slot(cells[i]);
+		next[i] = heads[s];
+		heads[s] = i;
+	}
+	// Find an inserted point within dist2 squared distance of point i, or NO_POINT
+	uint32_t find(uint32_t i, double dist2) const {
+		const Point &p = (*points)[i];
+		const Cell c = cell(p);
+		for (int64_t dz = -1; dz <= 1; ++dz) {
+			for (int64_t dy = -1; dy <= 1; ++dy) {
+				for (int64_t dx = -1; dx <= 1; ++dx) {
+					const Cell n{c.x + dx, c.y + dy, c.z + dz};
+					for (uint32_t j = heads[slot(n)]; j != NO_POINT; j = next[j]) {
+						if (cells[j].x != n.x || cells[j].y != n.y || cells[j].z != n.z) {
+							continue;
+						}
+						const Point &q = (*points)[j];
+						const double e[3] = {double(p.x) - q.x, double(p.y) - q.y, double(p.z) - q.z};
+						if (e[0] * e[0] + e[1] * e[1] + e[2] * e[2] <= dist2) {
+							return j;
+						}
+					}
+				}
+			}
+		}
+		return NO_POINT;
+	}
+};
+
+// Merge the near duplicates in the line, returning the number of points removed
+size_t merge_points(std::vector<Point> &points, PointGrid &grid, double dist2) {
+	const size_t n = points.size();
+	if (n < 2) {
+		return 0;
+	}
+	grid.reset(points);
+	std::vector<char> keep(n, 1);
+	size_t last_kept = 0;
+	grid.insert(0);
+	for (size_t i = 1; i < n; ++i) {
+		const uint32_t j = grid.find(uint32_t(i), dist2);
+		if (j == NO_POINT) {
+			grid.insert(uint32_t(i));
+			last_kept = i;
+		} else if (i + 1 < n) {
+			keep[i] = 0;
+		} else if (j == last_kept && j != 0) {
+			// The last point is kept for the branches coming off it, so the
+			// point it duplicates is dropped instead
+			keep[j] = 0;
+		}
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (keep[i]) {
+			points[kept++] = points[i];
+		}
+	}
+	points.resize(kept);
+	return n - kept;
+}
+
+size_t merge_tree(Tree &tree, const MergeOptions &options) {
+	PointGrid grid(options.distance);
+	const double dist2 = double(options.distance) * options.distance;
+	size_t removed = merge_points(tree.points, grid, dist2);
+	// Each branch with the point it comes off, if there is one
+	std::vector<std::pair<Branch*, const Point*>> stack;
+	const Point *tree_end = tree.points.empty() ? nullptr : &tree.points.back();
+	for (auto b = tree.branches.rbegin(); b != tree.branches.rend(); ++b) {
+		stack.push_back(std::make_pair(&*b, tree_end));
+	}
+	while (!stack.empty()) {
+		Branch *b = stack.back().first;
+		const Point *parent_end = stack.back().second;
+		stack.pop_back();
+		removed += merge_points(b->points, grid, dist2);
+		if (options.snap_branch_starts && parent_end && !b->points.empty()) {
+			Point &start = b->points.front();
+			const double e[3] = {double(start.x) - parent_end->x, double(start.y) - parent_end->y,
+				double(start.z) - parent_end->z};
+			if (e[0] * e[0] + e[1] * e[1] + e[2] * e[2] <= dist2) {
+				start.x = parent_end->x;
+				start.y = parent_end->y;
+				start.z = parent_end->z;
+			}
+		}
+		const Point *end = b->points.empty() ? parent_end : &b->points.back();
+		for (auto c = b->branches.rbegin(); c != b->branches.rend(); ++c) {
+			stack.push_back(std::make_pair(&*c, end));
+		}
+	}
+	return removed;
+}
+
+}
+
+void collapse_degree2(Branch &branch) {
+	std::vector<Branch*> stack(1, &branch);
+	while (!stack.empty()) {
+		Branch *b = stack.back();
+		stack.pop_back();
+		collapse_chain(*b);
+		for (auto &c : b->branches) {
+			stack.push_back(&c);
+		}
+	}
+}
+
+void collapse_degree2(NeuronData &data) {
+	for (auto &t : data.trees) {
+		for (auto &b : t.branches) {
+			collapse_degree2(b);
+		}
+	}
+}
+
+size_t decimate(NeuronData &data, const DecimateOptions &options) {
+	if (!(options.tolerance >= 0) || !(options.radius_tolerance >= 0)) {
+		throw std::runtime_error("Error: decimation tolerances must not be negative");
+	}
+	std::vector<std::vector<Point>*> lines;
+	std::vector<Branch*> stack;
+	for (auto &t : data.trees) {
+		lines.push_back(&t.points);
+		for (auto &b : t.branches) {
+			stack.push_back(&b);
+		}
+		while (!stack.empty()) {
+			Branch *b = stack.back();
+			stack.pop_back();
+			lines.push_back(&b->points);
+			for (auto &c : b->branches) {
+				stack.push_back(&c);
+			}
+		}
+	}
+	std::atomic<size_t> removed(0);
+	detail::parallel_for(lines.size(), options.num_threads, [&](size_t i) {
+		removed += decimate_points(*lines[i], options);
+	});
+	return removed;
+}
+
+size_t merge_duplicates(NeuronData &data, const MergeOptions &options) {
+	if (!(options.distance >= 0)) {
+		throw std::runtime_error("Error: the merge distance must not be negative");
+	}
+	std::atomic<size_t> removed(0);
+	detail::parallel_for(data.trees.size(), options.num_threads, [&](size_t i) {
+		removed += merge_tree(data.trees[i], options);
+	});
+	return removed;
+}
+
+}
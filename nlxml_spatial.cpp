@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include "nlxml_parallel.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+namespace {
+
+// Nodes with this many items or fewer are leaves
+const uint32_t LEAF_SIZE = 4;
+// Items are boxed in chunks of this many on the threads
+const size_t CHUNK_ITEMS = 1 << 16;
+
+struct Box {
+	float lo[3], hi[3];
+};
+
+/* The number of nodes in the hierarchy over n items. The sizes of the
+ * ranges split at each depth differ by at most one, so only a couple of
+ * sizes per depth are counted. Every size is counted up front so the
+ * threads only read it.
+ */
+class NodeCounts {
+	std::map<uint32_t, uint32_t> counts;
+
+	uint32_t count(uint32_t n) {
+		auto it = counts.find(n);
+		if (it != counts.end()) {
+			return it->second;
+		}
+		const uint32_t c = n <= LEAF_SIZE ? 1 : 1 + count(n / 2) + count(n - n / 2);
+		counts[n] = c;
+		return c;
+	}
+
+public:
+	NodeCounts(uint32_t n) {
+		count(n);
+	}
+
+	uint32_t operator[](uint32_t n) const {
+		return counts.find(n)->second;
+	}
+};
+
+struct Task {
+	uint32_t node, begin, end;
+};
+
+/* Set up the node for the items in the task's range, splitting the range
+ * at the median of the box centers on the longest axis if it's not a leaf.
+ * Returns the number of child tasks written to children.
+ */
+template<typename NodeT>
+size_t split_node(std::vector<NodeT> &nodes, std::vector<uint32_t> &items, const std::vector<Box> &boxes,
+		const NodeCounts &counts, const Task &t, Task children[2])
+{
+	NodeT &node = nodes[t.node];
+	float center_lo[3], center_hi[3];
+	for (size_t a = 0; a < 3; ++a) {
+		node.lo[a] = center_lo[a] = std::numeric_limits<float>::infinity();
+		node.hi[a] = center_hi[a] = -std::numeric_limits<float>::infinity();
+	}
+	for (uint32_t i = t.begin; i < t.end; ++i) {
+		const Box &b = boxes[items[i]];
+		for (size_t a = 0; a < 3; ++a) {
+			node.lo[a] = std::min(node.lo[a], b.lo[a]);
+			node.hi[a] = std::max(node.hi[a], b.hi[a]);
+			const float c = (b.lo[a] + b.hi[a]) / 2;
+			center_lo[a] = std::min(center_lo[a], c);
+			center_hi[a] = std::max(center_hi[a], c);
+		}
+	}
+	const uint32_t n = t.end - t.begin;
+	if (n <= LEAF_SIZE) {
+		node.first = t.begin;
+		node.count = n;
+		return 0;
+	}
+	size_t axis = 0;
+	for (size_t a = 1; a < 3; ++a) {
+		if (center_hi[a] - center_lo[a] > center_hi[axis] - center_lo[axis]) {
+			axis = a;
+		}
+	}
+	const uint32_t mid = t.begin + n / 2;
+	std::nth_element(items.begin() + t.begin, items.begin() + mid, items.begin() + t.end,
+		[&](uint32_t x, uint32_t y) {
+			const float cx = boxes[x].lo[axis] + boxes[x].hi[axis];
+			const float cy = boxes[y].lo[axis] + boxes[y].hi[axis];
+			return cx < cy || (cx == cy && x < y);
+		});
+	const uint32_t second = t.node + 1 + counts[n / 2];
+	node.first = second;
+	node.count = 0;
+	children[0] = Task{t.node + 1, t.begin, mid};
+	children[1] = Task{second, mid, t.end};
+	return 2;
+}
+
+// Build the hierarchy over the items, each with its box in boxes
+template<typename NodeT>
+void build_hierarchy(std::vector<NodeT> &nodes, std::vector<uint32_t> &items, const std::vector<Box> &boxes,
+		size_t num_threads)
+{
+	if (items.empty()) {
+		nodes.clear();
+		return;
+	}
+	const uint32_t n = static_cast<uint32_t>(items.size());
+	const NodeCounts counts(n);
+	nodes.resize(counts[n]);
+
+	// Split the top levels here until there are enough subtrees to share
+	// out, the subtrees don't overlap in the nodes or items
+	num_threads = detail::resolve_threads(num_threads);
+	const size_t target = num_threads > 1 ? num_threads * 8 : 1;
+	std::vector<Task> tasks(1, Task{0, 0, n});
+	while (!tasks.empty() && tasks.size() < target) {
+		std::vector<Task> next;
+		for (const auto &t : tasks) {
+			Task children[2];
+			const size_t c = split_node(nodes, items, boxes, counts, t, children);
+			next.insert(next.end(), children, children + c);
+		}
+		tasks.swap(next);
+	}
+	detail::parallel_for(tasks.size(), num_threads, [&](size_t i) {
+		std::vector<Task> stack(1, tasks[i]);
+		while (!stack.empty()) {
+			const Task t = stack.back();
+			stack.pop_back();
+			Task children[2];
+			const size_t c = split_node(nodes, items, boxes, counts, t, children);
+			stack.insert(stack.end(), children, children + c);
+		}
+	});
+}
+
+// Compute the box of each item on the threads
+template<typename F>
+std::vector<Box> make_boxes(size_t count, size_t num_threads, const F &box) {
+	std::vector<Box> boxes(count);
+	const size_t chunks = (count + CHUNK_ITEMS - 1) / CHUNK_ITEMS;
+	detail::parallel_for(chunks, num_threads, [&](size_t c) {
+		const size_t end = std::min(count, (c + 1) * CHUNK_ITEMS);
+		for (size_t i = c * CHUNK_ITEMS; i < end; ++i) {
+			boxes[i] = box(i);
+		}
+	});
+	return boxes;
+}
+
+// The bounds of the capsule from point a to point b
+Box segment_box(const std::vector<float> &x, const std::vector<float> &y, const std::vector<float> &z,
+		const std::vector<float> &d, uint32_t a, uint32_t b)
+{
+	const float r = std::max(std::abs(d[a]), std::abs(d[b])) / 2;
+	return Box{{std::min(x[a], x[b]) - r, std::min(y[a], y[b]) - r, std::min(z[a], z[b]) - r},
+		{std::max(x[a], x[b]) + r, std::max(y[a], y[b]) + r, std::max(z[a], z[b]) + r}};
+}
+
+template<typename NodeT>
+float box_distance2(const NodeT &node, const Point &p) {
+	const float c[3] = {p.x, p.y, p.z};
+	float d2 = 0;
+	for (size_t a = 0; a < 3; ++a) {
+		const float e = std::max(std::max(node.lo[a] - c[a], c[a] - node.hi[a]), 0.f);
+		d2 += e * e;
+	}
+	return d2;
+}
+
+template<typename NodeT>
+bool box_overlaps(const NodeT &node, const Point &lo, const Point &hi) {
+	return node.lo[0] <= hi.x && node.hi[0] >= lo.x && node.lo[1] <= hi.y && node.hi[1] >= lo.y
+		&& node.lo[2] <= hi.z && node.hi[2] >= lo.z;
+}
+
+/* Call item(i) for each item in the leaves whose boxes visit(node) returns
+ * true for, skipping the nodes below those it returns false for.
+ */
+template<typename H, typename V, typename F>
+void traverse(const H &h, const V &visit, const F &item) {
+	if (h.nodes.empty()) {
+		return;
+	}
+	std::vector<uint32_t> stack(1, 0);
+	while (!stack.empty()) {
+		const uint32_t i = stack.back();
+		stack.pop_back();
+		const auto &node = h.nodes[i];
+		if (!visit(node)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+				item(h.items[j]);
+			}
+		} else {
+			stack.push_back(node.first);
+			stack.push_back(i + 1);
+		}
+	}
+}
+
+/* Find the item closest to p by distance2(item), visiting the nearer child
+ * of each node first and skipping nodes further than the closest so far.
+ * Ties go to the lowest index.
+ */
+template<typename H, typename F>
+size_t nearest(const H &h, const Point &p, const F &distance2) {
+	size_t best = NO_INDEX;
+	float best_d2 = std::numeric_limits<float>::infinity();
+	if (h.nodes.empty()) {
+		return best;
+	}
+	std::vector<std::pair<float, uint32_t>> stack(1, std::make_pair(box_distance2(h.nodes[0], p), 0u));
+	while (!stack.empty()) {
+		const auto top = stack.back();
+		stack.pop_back();
+		if (top.first > best_d2) {
+			continue;
+		}
+		const auto &node = h.nodes[top.second];
+		if (node.count > 0) {
+			for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+				const uint32_t it = h.items[j];
+				const float d2 = distance2(it);
+				if (d2 < best_d2 || (d2 == best_d2 && it < best)) {
+					best_d2 = d2;
+					best = it;
+				}
+			}
+			continue;
+		}
+		const uint32_t a = top.second + 1;
+		const uint32_t b = node.first;
+		const float da = box_distance2(h.nodes[a], p);
+		const float db = box_distance2(h.nodes[b], p);
+		if (da <= db) {
+			stack.push_back(std::make_pair(db, b));
+			stack.push_back(std::make_pair(da, a));
+		} else {
+			stack.push_back(std::make_pair(da, a));
+			stack.push_back(std::make_pair(db, b));
+		}
+	}
+	return best;
+}
+
+std::vector<size_t> sorted(std::vector<size_t> v) {
+	std::sort(v.begin(), v.end());
+	return v;
+}
+
+}
+
+SpatialIndex::SpatialIndex(const NeuronData &data, size_t num_threads)
+	: SpatialIndex(to_flat(data), num_threads)
+{}
+
+SpatialIndex::SpatialIndex(const FlatNeuronData &data, size_t num_threads)
+	: xs(data.x), ys(data.y), zs(data.z), ds(data.d)
+{
+	if (xs.size() > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Error: too many points to index");
+	}
+	std::vector<uint32_t> point_items;
+	for (size_t i = 0; i < data.branches.size(); ++i) {
+		const FlatBranch &b = data.branches[i];
+		if (b.num_points == 0) {
+			continue;
+		}
+		// Join the branch to the last point of the closest parent with points
+		int32_t parent = b.parent;
+		while (parent != -1 && data.branches[parent].num_points == 0) {
+			parent = data.branches[parent].parent;
+		}
+		if (parent != -1) {
+			const FlatBranch &p = data.branches[parent];
+			segment_points.push_back(p.first_point + p.num_points - 1);
+			segment_points.push_back(b.first_point);
+		}
+		for (uint32_t j = b.first_point; j < b.first_point + b.num_points; ++j) {
+			point_items.push_back(j);
+			if (j + 1 < b.first_point + b.num_points) {
+				segment_points.push_back(j);
+				segment_points.push_back(j + 1);
+			}
+		}
+	}
+	build(point_items, num_threads);
+}
+
+SpatialIndex::SpatialIndex(const float *x, const float *y, const float *z, const float *d, size_t count,
+		size_t num_threads)
+	: xs(x, x + count), ys(y, y + count), zs(z, z + count), ds(d, d + count)
+{
+	if (count > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Error: too many points to index");
+	}
+	std::vector<uint32_t> point_items(count);
+	for (size_t i = 0; i < count; ++i) {
+		point_items[i] = static_cast<uint32_t>(i);
+	}
+	build(point_items, num_threads);
+}
+
+void SpatialIndex::build(const std::vector<uint32_t> &point_items, size_t num_threads) {
+	const std::vector<Box> point_boxes = make_boxes(xs.size(), num_threads, [&](size_t i) {
+		return Box{{xs[i], ys[i], zs[i]}, {xs[i], ys[i], zs[i]}};
+	});
+	points.items = point_items;
+	build_hierarchy(points.nodes, points.items, point_boxes, num_threads);
+
+	const std::vector<Box> segment_boxes = make_boxes(num_segments(), num_threads, [&](size_t i) {
+		return segment_box(xs, ys, zs, ds, segment_points[2 * i], segment_points[2 * i + 1]);
+	});
+	segments.items.resize(num_segments());
+	for (size_t i = 0; i < segments.items.size(); ++i) {
+		segments.items[i] = static_cast<uint32_t>(i);
+	}
+	build_hierarchy(segments.nodes, segments.items, segment_boxes, num_threads);
+}
+
+size_t SpatialIndex::num_points() const {
+	return xs.size();
+}
+
+size_t SpatialIndex::num_segments() const {
+	return segment_points.size() / 2;
+}
+
+Point SpatialIndex::point(size_t i) const {
+	return Point(xs[i], ys[i], zs[i], ds[i]);
+}
+
+size_t SpatialIndex::segment_start(size_t i) const {
+	return segment_points[2 * i];
+}
+
+size_t SpatialIndex::segment_end(size_t i) const {
+	return segment_points[2 * i + 1];
+}
+
+size_t SpatialIndex::nearest_point(const Point &p) const {
+	return nearest(points, p, [&](uint32_t i) {
+		const float dx = xs[i] - p.x;
+		const float dy = ys[i] - p.y;
+		const float dz = zs[i] - p.z;
+		return dx * dx + dy * dy + dz * dz;
+	});
+}
+
+std::vector<size_t> SpatialIndex::points_in_radius(const Point &p, float radius) const {
+	std::vector<size_t> found;
+	const float r2 = radius * radius;
+	traverse(points, [&](const Node &n) { return box_distance2(n, p) <= r2; },
+		[&](uint32_t i) {
+			const float dx = xs[i] - p.x;
+			const float dy = ys[i] - p.y;
+			const float dz = zs[i] - p.z;
+			if (dx * dx + dy * dy + dz * dz <= r2) {
+				found.push_back(i);
+			}
+		});
+	return sorted(std::move(found));
+}
+
+std::vector<size_t> SpatialIndex::points_in_box(const Point &lo, const Point &hi) const {
+	std::vector<size_t> found;
+	traverse(points, [&](const Node &n) { return box_overlaps(n, lo, hi); },
+		[&](uint32_t i) {
+			if (xs[i] >= lo.x && xs[i] <= hi.x && ys[i] >= lo.y && ys[i] <= hi.y
+					&& zs[i] >= lo.z && zs[i] <= hi.z)
+			{
+				found.push_back(i);
+			}
+		});
+	return sorted(std::move(found));
+}
+
+float SpatialIndex::segment_distance(size_t i, const Point &p) const {
+	const uint32_t a = segment_points[2 * i];
+	const uint32_t b = segment_points[2 * i + 1];
+	const float v[3] = {xs[b] - xs[a], ys[b] - ys[a], zs[b] - zs[a]};
+	const float w[3] = {p.x - xs[a], p.y - ys[a], p.z - zs[a]};
+	const float len2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	float t = 0;
+	if (len2 > 0) {
+		t = (w[0] * v[0] + w[1] * v[1] + w[2] * v[2]) / len2;
+		t = std::min(std::max(t, 0.f), 1.f);
+	}
+	float dist2 = 0;
+	for (size_t j = 0; j < 3; ++j) {
+		const float e = w[j] - t * v[j];
+		dist2 += e * e;
+	}
+	const float radius = (std::abs(ds[a]) + t * (std::abs(ds[b]) - std::abs(ds[a]))) / 2;
+	return std::max(std::sqrt(dist2) - radius, 0.f);
+}
+
+size_t SpatialIndex::nearest_segment(const Point &p) const {
+	return nearest(segments, p, [&](uint32_t i) {
+		const float d = segment_distance(i, p);
+		return d * d;
+	});
+}
+
+std::vector<size_t> SpatialIndex::segments_in_radius(const Point &p, float radius) const {
+	std::vector<size_t> found;
+	traverse(segments, [&](const Node &n) { return box_distance2(n, p) <= radius * radius; },
+		[&](uint32_t i) {
+			if (segment_distance(i, p) <= radius) {
+				found.push_back(i);
+			}
+		});
+	return sorted(std::move(found));
+}
+
+std::vector<size_t> SpatialIndex::segments_in_box(const Point &lo, const Point &hi) const {
+	std::vector<size_t> found;
+	traverse(segments, [&](const Node &n) { return box_overlaps(n, lo, hi); },
+		[&](uint32_t i) {
+			if (box_overlaps(segment_box(xs, ys, zs, ds, segment_points[2 * i], segment_points[2 * i + 1]),
+					lo, hi))
+			{
+				found.push_back(i);
+			}
+		});
+	return sorted(std::move(found));
+}
+
+}
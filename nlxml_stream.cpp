@@ -0,0 +1,589 @@
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include "tinyxml2.h"
+#include "nlxml_parallel.h"
+#include "nlxml_reader.h"
+#include "nlxml_transform.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+using namespace detail;
+
+ImportHandler::~ImportHandler() {}
+void ImportHandler::begin_tree(const Tree &) {}
+void ImportHandler::end_tree() {}
+void ImportHandler::begin_branch(const std::string &) {}
+void ImportHandler::end_branch() {}
+void ImportHandler::begin_contour(const Contour &) {}
+void ImportHandler::end_contour() {}
+void ImportHandler::begin_marker(const Marker &) {}
+void ImportHandler::end_marker() {}
+void ImportHandler::point(const Point &) {}
+void ImportHandler::image(const Image &) {}
+
+namespace {
+
+// Builds up the NeuronData from the elements streamed in by the parser
+class NeuronDataBuilder : public ImportHandler {
+	NeuronData data;
+	Tree tree;
+	Contour contour;
+	Marker marker;
+	// The stack of currently open branches in the tree
+	std::vector<Branch> branches;
+	bool in_tree = false;
+	bool in_contour = false;
+	bool in_marker = false;
+
+public:
+	void begin_tree(const Tree &t) override {
+		tree = t;
+		in_tree = true;
+	}
+	void end_tree() override {
+		data.trees.push_back(std::move(tree));
+		tree = Tree();
+		in_tree = false;
+	}
+	void begin_branch(const std::string &leaf) override {
+		branches.push_back(Branch());
+		branches.back().leaf = leaf;
+	}
+	void end_branch() override {
+		Branch b = std::move(branches.back());
+		branches.pop_back();
+		if (branches.empty()) {
+			tree.branches.push_back(std::move(b));
+		} else {
+			branches.back().branches.push_back(std::move(b));
+		}
+	}
+	void begin_contour(const Contour &c) override {
+		contour = c;
+		in_contour = true;
+	}
+	void end_contour() override {
+		data.contours.push_back(std::move(contour));
+		contour = Contour();
+		in_contour = false;
+	}
+	void begin_marker(const Marker &m) override {
+		marker = m;
+		in_marker = true;
+	}
+	void end_marker() override {
+		in_marker = false;
+		current_markers().push_back(std::move(marker));
+		marker = Marker();
+	}
+	void point(const Point &p) override {
+		current_points().push_back(p);
+	}
+	void image(const Image &i) override {
+		data.images.push_back(i);
+	}
+	NeuronData take() {
+		return std::move(data);
+	}
+
+private:
+	std::vector<Point>& current_points() {
+		if (in_marker) {
+			return marker.points;
+		}
+		if (!branches.empty()) {
+			return branches.back().points;
+		}
+		return in_tree ? tree.points : contour.points;
+	}
+	std::vector<Marker>& current_markers() {
+		if (!branches.empty()) {
+			return branches.back().markers;
+		}
+		if (in_tree) {
+			return tree.markers;
+		}
+		return in_contour ? contour.markers : data.markers;
+	}
+};
+
+std::string attribute(const XMLReader &r, const char *name) {
+	const XMLAttrib *a = r.find_attribute(name);
+	if (!a) {
+		throw std::runtime_error("Error: <" + r.name().str() + "> element is missing the '"
+				+ name + "' attribute");
+	}
+	return decode(a->value, a->needs_decode);
+}
+// The numeric attributes are converted to match the tinyxml2 functions the
+// DOM importer uses, and take the same default when missing or unreadable
+float float_attribute(const XMLReader &r, const char *name) {
+	const XMLAttrib *a = r.find_attribute(name);
+	float f = 0;
+	if (a && !a->needs_decode) {
+		parse_float(a->value.begin, a->value.end, &f);
+	} else if (a) {
+		const std::string value = decode(a->value, true);
+		parse_float(value.data(), value.data() + value.size(), &f);
+	}
+	return f;
+}
+bool bool_attribute(const XMLReader &r, const char *name) {
+	const XMLAttrib *a = r.find_attribute(name);
+	bool b = false;
+	if (a) {
+		tinyxml2::XMLUtil::ToBool(decode(a->value, a->needs_decode).c_str(), &b);
+	}
+	return b;
+}
+unsigned unsigned_attribute(const XMLReader &r, const char *name) {
+	const XMLAttrib *a = r.find_attribute(name);
+	unsigned u = 0;
+	if (a) {
+		tinyxml2::XMLUtil::ToUnsigned(decode(a->value, a->needs_decode).c_str(), &u);
+	}
+	return u;
+}
+std::string optional_attribute(const XMLReader &r, const char *name) {
+	const XMLAttrib *a = r.find_attribute(name);
+	return a ? decode(a->value, a->needs_decode) : std::string();
+}
+// Read the text content of the element just started, as XMLElement::GetText would
+std::string read_text(XMLReader &r) {
+	const size_t depth = r.depth();
+	std::string text;
+	if (r.next() == XMLReader::TEXT) {
+		text = r.is_cdata() ? r.text().str() : decode(r.text(), true);
+	}
+	while (r.depth() >= depth) {
+		r.next();
+	}
+	return text;
+}
+
+// Each of the stream_* functions is called with the reader on the start
+// tag of the element, and returns once its end tag has been read
+Point stream_point(XMLReader &r, const ImportOptions &options) {
+	Point p;
+	p.x = float_attribute(r, "x");
+	p.y = float_attribute(r, "y");
+	p.z = float_attribute(r, "z");
+	p.d = float_attribute(r, "d");
+	r.skip_element();
+	if (!options.matrix.empty()) {
+		detail::transform_points(&p, 1, options.matrix.data());
+	}
+	return p;
+}
+void stream_marker(XMLReader &r, ImportHandler &handler, const ImportOptions &options) {
+	Marker m;
+	m.type = attribute(r, "type");
+	m.color = parse_color(attribute(r, "color"));
+	m.name = attribute(r, "name");
+	m.varicosity = bool_attribute(r, "varicosity");
+	handler.begin_marker(m);
+	while (r.next_child()) {
+		if (r.name() == "point") {
+			handler.point(stream_point(r, options));
+		} else {
+			r.skip_element();
+		}
+	}
+	handler.end_marker();
+}
+void stream_contour(XMLReader &r, ImportHandler &handler, const ImportOptions &options) {
+	Contour c;
+	c.name = attribute(r, "name");
+	c.color = parse_color(attribute(r, "color"));
+	c.closed = bool_attribute(r, "closed");
+	c.shape = attribute(r, "shape");
+	handler.begin_contour(c);
+	while (r.next_child()) {
+		if (r.name() == "point") {
+			handler.point(stream_point(r, options));
+		} else if (r.name() == "marker" && options.branch_markers) {
+			stream_marker(r, handler, options);
+		} else {
+			r.skip_element();
+		}
+	}
+	handler.end_contour();
+}
+void stream_branch(XMLReader &r, ImportHandler &handler, const ImportOptions &options) {
+	const XMLAttrib *leaf = r.find_attribute("leaf");
+	handler.begin_branch(leaf ? decode(leaf->value, leaf->needs_decode) : "Unspecified");
+	while (r.next_child()) {
+		if (r.name() == "point") {
+			handler.point(stream_point(r, options));
+		} else if (r.name() == "marker" && options.branch_markers) {
+			stream_marker(r, handler, options);
+		} else if (r.name() == "branch") {
+			stream_branch(r, handler, options);
+		} else {
+			r.skip_element();
+		}
+	}
+	handler.end_branch();
+}
+void stream_tree(XMLReader &r, ImportHandler &handler, const ImportOptions &options) {
+	Tree t;
+	t.type = attribute(r, "type");
+	if (options.tree_filter && !options.tree_filter(t.type)) {
+		r.skip_element();
+		return;
+	}
+	t.color = parse_color(attribute(r, "color"));
+	t.leaf = attribute(r, "leaf");
+	handler.begin_tree(t);
+	while (r.next_child()) {
+		if (r.name() == "point") {
+			handler.point(stream_point(r, options));
+		} else if (r.name() == "marker" && options.branch_markers) {
+			stream_marker(r, handler, options);
+		} else if (r.name() == "branch") {
+			stream_branch(r, handler, options);
+		} else {
+			r.skip_element();
+		}
+	}
+	handler.end_tree();
+}
+Image stream_image(XMLReader &r) {
+	Image i;
+	while (r.next_child()) {
+		if (r.name() == "filename") {
+			i.filenames.push_back(read_text(r));
+			continue;
+		} else if (r.name() == "scale") {
+			i.scale[0] = float_attribute(r, "x");
+			i.scale[1] = float_attribute(r, "y");
+		} else if (r.name() == "coord") {
+			i.coord[0] = float_attribute(r, "x");
+			i.coord[1] = float_attribute(r, "y");
+			i.coord[2] = float_attribute(r, "z");
+		} else if (r.name() == "zspacing") {
+			i.z_spacing = float_attribute(r, "z");
+			i.slices = unsigned_attribute(r, "slices");
+		}
+		r.skip_element();
+	}
+	return i;
+}
+// Stream one child element of the <mbf> root through the handler, elements
+// not selected by the options are skipped without being parsed
+void stream_element(XMLReader &r, ImportHandler &handler, const ImportOptions &options) {
+	if (r.name() == "contour" && options.contours) {
+		stream_contour(r, handler, options);
+	} else if (r.name() == "tree") {
+		stream_tree(r, handler, options);
+	} else if (r.name() == "marker" && options.markers) {
+		stream_marker(r, handler, options);
+	} else if (r.name() == "images" && options.images) {
+		while (r.next_child()) {
+			if (r.name() == "image") {
+				handler.image(stream_image(r));
+			} else {
+				r.skip_element();
+			}
+		}
+	} else {
+		r.skip_element();
+	}
+}
+
+// Read up to the start of the root element. Its children are the trees,
+// contours, markers and images
+void read_root(XMLReader &r) {
+	while (r.next() != XMLReader::START_ELEMENT) {
+		if (r.token() == XMLReader::END_DOCUMENT) {
+			throw std::runtime_error("Error: XML document has no root element");
+		}
+	}
+}
+
+NeuronData import_parallel(const char *data, size_t size, const ImportOptions &user_options) {
+	std::vector<ElementInfo> elements = scan_elements(data, size);
+	const ImportOptions options = resolve_transform(data, size, user_options, &elements);
+	elements.erase(std::remove_if(elements.begin(), elements.end(),
+				[&](const ElementInfo &e) { return !selected(e, options); }),
+			elements.end());
+
+	// Parse the largest elements first so one big tree isn't left running
+	// alone at the end
+	std::vector<size_t> order(elements.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](const size_t a, const size_t b) {
+			return elements[a].end - elements[a].begin > elements[b].end - elements[b].begin;
+		});
+
+	std::vector<NeuronData> parsed(elements.size());
+	parallel_for(order.size(), options.num_threads,
+		[&](const size_t i) {
+			NeuronDataBuilder builder;
+			parse_element(data, elements[order[i]], builder, options);
+			parsed[order[i]] = builder.take();
+		});
+
+	// Assemble the elements back in document order
+	NeuronData result;
+	for (auto &p : parsed) {
+		std::move(p.images.begin(), p.images.end(), std::back_inserter(result.images));
+		std::move(p.trees.begin(), p.trees.end(), std::back_inserter(result.trees));
+		std::move(p.contours.begin(), p.contours.end(), std::back_inserter(result.contours));
+		std::move(p.markers.begin(), p.markers.end(), std::back_inserter(result.markers));
+	}
+	return result;
+}
+
+/* Apply the options to data loaded from a binary file, giving the same
+ * result as importing the XML it was saved from with them. The image
+ * transform is found before the images are dropped.
+ */
+NeuronData select_binary(NeuronData data, const ImportOptions &user_options) {
+	const ImportOptions options = resolve_transform(data.images, user_options);
+	if (options.tree_filter) {
+		data.trees.erase(std::remove_if(data.trees.begin(), data.trees.end(),
+					[&](const Tree &t) { return !options.tree_filter(t.type); }),
+				data.trees.end());
+	}
+	if (!options.contours) {
+		data.contours.clear();
+	}
+	if (!options.markers) {
+		data.markers.clear();
+	}
+	if (!options.images) {
+		data.images.clear();
+	}
+	if (!options.branch_markers) {
+		std::vector<Branch*> stack;
+		for (auto &t : data.trees) {
+			t.markers.clear();
+			for (auto &b : t.branches) {
+				stack.push_back(&b);
+			}
+		}
+		while (!stack.empty()) {
+			Branch *b = stack.back();
+			stack.pop_back();
+			b->markers.clear();
+			for (auto &c : b->branches) {
+				stack.push_back(&c);
+			}
+		}
+		for (auto &c : data.contours) {
+			c.markers.clear();
+		}
+	}
+	if (!options.matrix.empty()) {
+		transform(data, options.matrix.data(), options.num_threads);
+	}
+	return data;
+}
+
+}
+
+namespace detail {
+
+// Index the top-level elements holding data without parsing them
+std::vector<ElementInfo> scan_elements(const char *data, size_t size) {
+	XMLReader r(data, data + size);
+	read_root(r);
+	std::vector<ElementInfo> elements;
+	while (r.next_child()) {
+		ElementInfo e;
+		if (r.name() == "tree") {
+			e.kind = ElementKind::TREE;
+			e.type = optional_attribute(r, "type");
+		} else if (r.name() == "contour") {
+			e.kind = ElementKind::CONTOUR;
+			e.name = optional_attribute(r, "name");
+		} else if (r.name() == "marker") {
+			e.kind = ElementKind::MARKER;
+			e.type = optional_attribute(r, "type");
+			e.name = optional_attribute(r, "name");
+		} else if (r.name() == "images") {
+			e.kind = ElementKind::IMAGES;
+		} else {
+			r.skip_element();
+			continue;
+		}
+		const std::string color = optional_attribute(r, "color");
+		if (!color.empty()) {
+			e.color = parse_color(color);
+		}
+		e.begin = r.token_begin() - data;
+		e.num_points = r.skip_element("point");
+		e.end = r.position() - data;
+		elements.push_back(e);
+	}
+	return elements;
+}
+// Stream a top-level element found by scan_elements through the handler
+void parse_element(const char *data, const ElementInfo &e, ImportHandler &handler,
+		const ImportOptions &options)
+{
+	XMLReader r(data + e.begin, data + e.end);
+	r.next();
+	stream_element(r, handler, options);
+}
+ImportOptions resolve_transform(const char *data, size_t size, const ImportOptions &options,
+		const std::vector<ElementInfo> *elements)
+{
+	if (!options.matrix.empty() && options.matrix.size() != 16) {
+		throw std::runtime_error("Error: the import matrix must have 16 elements");
+	}
+	if (options.image_transform == ImageTransform::NONE) {
+		return options;
+	}
+
+	// Find the file's first image
+	std::vector<Image> images;
+	if (elements) {
+		for (const auto &e : *elements) {
+			if (e.kind == ElementKind::IMAGES) {
+				NeuronDataBuilder builder;
+				parse_element(data, e, builder, ImportOptions());
+				images = builder.take().images;
+				break;
+			}
+		}
+	} else {
+		XMLReader r(data, data + size);
+		read_root(r);
+		while (r.next_child()) {
+			if (r.name() == "images") {
+				NeuronDataBuilder builder;
+				stream_element(r, builder, ImportOptions());
+				images = builder.take().images;
+				break;
+			}
+			r.skip_element();
+		}
+	}
+
+	return resolve_transform(images, options);
+}
+ImportOptions resolve_transform(const std::vector<Image> &images, const ImportOptions &options) {
+	if (!options.matrix.empty() && options.matrix.size() != 16) {
+		throw std::runtime_error("Error: the import matrix must have 16 elements");
+	}
+	ImportOptions resolved = options;
+	resolved.image_transform = ImageTransform::NONE;
+	if (options.image_transform == ImageTransform::NONE || images.empty()) {
+		return resolved;
+	}
+	float image_mat[16];
+	image_matrix(images[0], options.image_transform == ImageTransform::INVERT, image_mat);
+	if (options.matrix.empty()) {
+		resolved.matrix.assign(image_mat, image_mat + 16);
+	} else {
+		resolved.matrix.resize(16);
+		multiply(options.matrix.data(), image_mat, resolved.matrix.data());
+	}
+	return resolved;
+}
+bool selected(const ElementInfo &e, const ImportOptions &options) {
+	switch (e.kind) {
+		case ElementKind::TREE: return !options.tree_filter || options.tree_filter(e.type);
+		case ElementKind::CONTOUR: return options.contours;
+		case ElementKind::MARKER: return options.markers;
+		case ElementKind::IMAGES: return options.images;
+	}
+	return false;
+}
+
+}
+
+void parse_buffer(const char *data, size_t size, ImportHandler &handler, const ImportOptions &user_options) {
+	const ImportOptions options = resolve_transform(data, size, user_options);
+	XMLReader r(data, data + size);
+	read_root(r);
+	while (r.next_child()) {
+		stream_element(r, handler, options);
+	}
+}
+void parse_file(const std::string &fname, ImportHandler &handler, const ImportOptions &options) {
+	const MappedFile file(fname);
+	parse_buffer(file.data(), file.size(), handler, options);
+}
+NeuronData import_file(const std::string &fname, const ImportOptions &options) {
+	if (is_binary_file(fname)) {
+		return select_binary(load_binary(fname), options);
+	}
+	const MappedFile file(fname);
+	return import_buffer(file.data(), file.size(), options);
+}
+NeuronData import_file_stream(const std::string &fname) {
+	return import_file(fname, ImportOptions());
+}
+NeuronData import_buffer(const char *data, size_t size, const ImportOptions &options) {
+	if (options.num_threads != 1) {
+		return import_parallel(data, size, options);
+	}
+	NeuronDataBuilder builder;
+	parse_buffer(data, size, builder, options);
+	return builder.take();
+}
+NeuronData import_buffer_parallel(const char *data, size_t size, size_t num_threads) {
+	ImportOptions options;
+	options.num_threads = num_threads;
+	return import_parallel(data, size, options);
+}
+NeuronData import_file_parallel(const std::string &fname, size_t num_threads) {
+	const MappedFile file(fname);
+	return import_buffer_parallel(file.data(), file.size(), num_threads);
+}
+
+LazyNeuronFile::LazyNeuronFile(const std::string &fname)
+	: file(fname), index(scan_elements(file.data(), file.size()))
+{}
+const std::vector<ElementInfo>& LazyNeuronFile::elements() const {
+	return index;
+}
+Tree LazyNeuronFile::load_tree(size_t i) const {
+	if (index.at(i).kind != ElementKind::TREE) {
+		throw std::runtime_error("Error: element " + std::to_string(i) + " is not a tree");
+	}
+	NeuronDataBuilder builder;
+	parse_element(i, builder, ImportOptions());
+	return std::move(builder.take().trees[0]);
+}
+Contour LazyNeuronFile::load_contour(size_t i) const {
+	if (index.at(i).kind != ElementKind::CONTOUR) {
+		throw std::runtime_error("Error: element " + std::to_string(i) + " is not a contour");
+	}
+	NeuronDataBuilder builder;
+	parse_element(i, builder, ImportOptions());
+	return std::move(builder.take().contours[0]);
+}
+Marker LazyNeuronFile::load_marker(size_t i) const {
+	if (index.at(i).kind != ElementKind::MARKER) {
+		throw std::runtime_error("Error: element " + std::to_string(i) + " is not a marker");
+	}
+	NeuronDataBuilder builder;
+	parse_element(i, builder, ImportOptions());
+	return std::move(builder.take().markers[0]);
+}
+std::vector<Image> LazyNeuronFile::load_images(size_t i) const {
+	if (index.at(i).kind != ElementKind::IMAGES) {
+		throw std::runtime_error("Error: element " + std::to_string(i) + " is not an images list");
+	}
+	NeuronDataBuilder builder;
+	parse_element(i, builder, ImportOptions());
+	return builder.take().images;
+}
+void LazyNeuronFile::parse_element(size_t i, ImportHandler &handler, const ImportOptions &options) const {
+	detail::parse_element(file.data(), index.at(i), handler,
+			detail::resolve_transform(file.data(), file.size(), options, &index));
+}
+
+}
+
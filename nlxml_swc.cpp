@@ -0,0 +1,557 @@
+#include <string>
+#include <fstream>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "nlxml_reader.h"
+#include "nlxml_transform.h"
+#include "nlxml_writer.h"
+#include "nlxml.h"
+
+namespace nlxml {
+
+size_t SWCData::size() const {
+	return ids.size();
+}
+
+namespace {
+
+/* Reads the whitespace separated fields of an SWC file in place, without
+ * copying lines or tokens out of the buffer.
+ */
+class SWCTokenizer {
+	const char *pos;
+	const char *end;
+	size_t line;
+
+public:
+	SWCTokenizer(const char *data, size_t size) : pos(data), end(data + size), line(1) {}
+
+	// Move to the first field of the next sample line, skipping blank lines
+	// and comments. Returns false at the end of the file
+	bool next_line() {
+		while (pos != end) {
+			skip_spaces();
+			if (pos == end) {
+				break;
+			}
+			if (*pos != '\n' && *pos != '#') {
+				return true;
+			}
+			skip_line();
+		}
+		return false;
+	}
+	// Skip any fields left on the line along with the newline
+	void skip_line() {
+		while (pos != end && *pos != '\n') {
+			++pos;
+		}
+		if (pos != end) {
+			++pos;
+			++line;
+		}
+	}
+	int32_t int_field(const char *name) {
+		const char *begin = field(name);
+		const char *p = begin;
+		const bool negative = *p == '-';
+		if (*p == '-' || *p == '+') {
+			++p;
+		}
+		int64_t v = 0;
+		for (; p != pos && *p >= '0' && *p <= '9'; ++p) {
+			v = v * 10 + (*p - '0');
+			if (v > std::numeric_limits<int32_t>::max()) {
+				error(name, begin);
+			}
+		}
+		if (p != pos || p == begin || !(p[-1] >= '0' && p[-1] <= '9')) {
+			error(name, begin);
+		}
+		return static_cast<int32_t>(negative ? -v : v);
+	}
+	float float_field(const char *name) {
+		const char *begin = field(name);
+		float v;
+		if (!detail::parse_float(begin, pos, &v)) {
+			error(name, begin);
+		}
+		return v;
+	}
+
+private:
+	void skip_spaces() {
+		while (pos != end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) {
+			++pos;
+		}
+	}
+	// Find the next field on the line, leaving pos at its end
+	const char* field(const char *name) {
+		skip_spaces();
+		const char *begin = pos;
+		while (pos != end && *pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n') {
+			++pos;
+		}
+		if (begin == pos) {
+			throw std::runtime_error("Error: SWC line " + std::to_string(line)
+					+ " is missing the " + name + " field");
+		}
+		return begin;
+	}
+	[[noreturn]] void error(const char *name, const char *begin) const {
+		throw std::runtime_error("Error: SWC line " + std::to_string(line) + " has an invalid "
+				+ name + " '" + std::string(begin, pos) + "'");
+	}
+};
+
+// Find the index of each id, using a flat table when the ids are reasonably
+// dense as they are in most files, and a hash map otherwise
+class IdIndex {
+	int32_t min_id;
+	std::vector<int32_t> table;
+	std::unordered_map<int32_t, int32_t> map;
+	bool dense;
+
+public:
+	IdIndex(const std::vector<int32_t> &ids) : min_id(0), dense(true) {
+		if (ids.empty()) {
+			return;
+		}
+		const auto range = std::minmax_element(ids.begin(), ids.end());
+		min_id = *range.first;
+		const uint64_t span = static_cast<uint64_t>(static_cast<int64_t>(*range.second) - min_id) + 1;
+		dense = span <= 4 * static_cast<uint64_t>(ids.size()) + 1024;
+		if (dense) {
+			table.resize(span, -1);
+		} else {
+			map.reserve(ids.size());
+		}
+		for (size_t i = 0; i < ids.size(); ++i) {
+			int32_t &slot = dense ? table[ids[i] - min_id] : map.emplace(ids[i], -1).first->second;
+			if (slot != -1) {
+				throw std::runtime_error("Error: SWC sample id " + std::to_string(ids[i])
+						+ " is used more than once");
+			}
+			slot = static_cast<int32_t>(i);
+		}
+	}
+	int32_t find(int32_t id) const {
+		if (dense) {
+			const int64_t i = static_cast<int64_t>(id) - min_id;
+			return i >= 0 && i < static_cast<int64_t>(table.size()) ? table[i] : -1;
+		}
+		auto fnd = map.find(id);
+		return fnd != map.end() ? fnd->second : -1;
+	}
+	// The indices of the samples sorted by id
+	std::vector<uint32_t> sorted(const std::vector<int32_t> &ids) const {
+		std::vector<uint32_t> order;
+		if (dense) {
+			order.reserve(table.size());
+			for (const auto &i : table) {
+				if (i != -1) {
+					order.push_back(static_cast<uint32_t>(i));
+				}
+			}
+		} else {
+			order.reserve(map.size());
+			for (const auto &e : map) {
+				order.push_back(static_cast<uint32_t>(e.second));
+			}
+			std::sort(order.begin(), order.end(),
+				[&](const uint32_t a, const uint32_t b) { return ids[a] < ids[b]; });
+		}
+		return order;
+	}
+};
+
+}
+
+SWCData read_swc_buffer(const char *data, size_t size) {
+	SWCData swc;
+	// Sample lines are usually 30-60 chars
+	const size_t estimate = size / 40;
+	swc.ids.reserve(estimate);
+	swc.types.reserve(estimate);
+	swc.parent_ids.reserve(estimate);
+	swc.x.reserve(estimate);
+	swc.y.reserve(estimate);
+	swc.z.reserve(estimate);
+	swc.radius.reserve(estimate);
+
+	SWCTokenizer tok(data, size);
+	while (tok.next_line()) {
+		swc.ids.push_back(tok.int_field("id"));
+		swc.types.push_back(tok.int_field("type"));
+		swc.x.push_back(tok.float_field("x"));
+		swc.y.push_back(tok.float_field("y"));
+		swc.z.push_back(tok.float_field("z"));
+		swc.radius.push_back(tok.float_field("radius"));
+		swc.parent_ids.push_back(tok.int_field("parent"));
+		tok.skip_line();
+	}
+	if (swc.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+		throw std::runtime_error("Error: SWC file has too many samples");
+	}
+
+	const size_t n = swc.size();
+	IdIndex index(swc.ids);
+	swc.parents.resize(n);
+	std::vector<uint32_t> num_children(n + 1, 0);
+	for (size_t i = 0; i < n; ++i) {
+		const int32_t parent = swc.parent_ids[i] == -1 ? -1 : index.find(swc.parent_ids[i]);
+		swc.parents[i] = parent;
+		if (parent != -1) {
+			++num_children[parent + 1];
+		}
+	}
+
+	// Fill the CSR children lists, walking the samples in id order so each
+	// list comes out sorted by id
+	swc.child_offsets.resize(n + 1, 0);
+	for (size_t i = 0; i < n; ++i) {
+		swc.child_offsets[i + 1] = swc.child_offsets[i] + num_children[i + 1];
+	}
+	swc.children.resize(swc.child_offsets[n]);
+	std::vector<uint32_t> next(swc.child_offsets.begin(), swc.child_offsets.end() - 1);
+	for (const auto &i : index.sorted(swc.ids)) {
+		const int32_t parent = swc.parents[i];
+		if (parent == -1) {
+			swc.roots.push_back(i);
+		} else {
+			swc.children[next[parent]++] = i;
+		}
+	}
+	return swc;
+}
+SWCData read_swc(const std::string &fname) {
+	const MappedFile file(fname);
+	return read_swc_buffer(file.data(), file.size());
+}
+
+namespace {
+
+// NLXML points store the diameter rather than the radius
+Point swc_point(const SWCData &swc, uint32_t i) {
+	return Point(swc.x[i], swc.y[i], swc.z[i], 2.f * swc.radius[i]);
+}
+
+const char *SWC_TYPE_NAMES[] = {"Undefined", "Soma", "Axon", "Dendrite", "Apical Dendrite",
+	"Undefined", "Undefined", "Custom"};
+
+const char* swc_type_name(int32_t code) {
+	return code >= 0 && code <= 7 ? SWC_TYPE_NAMES[code] : SWC_TYPE_NAMES[0];
+}
+int32_t swc_type_code(const std::string &name) {
+	for (int32_t i = 1; i <= 7; ++i) {
+		if (name == SWC_TYPE_NAMES[i]) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/* Add the unbranched run of samples starting at s to the branch, then make
+ * an empty child branch for each child of the sample it forks at. The
+ * children are sized up front so the branch's child vector is never
+ * reallocated, keeping the pointers pushed to the stack valid.
+ */
+template<typename T>
+void convert_run(T &branch, uint32_t s, const SWCData &swc,
+		std::vector<std::pair<Branch*, uint32_t>> &stack)
+{
+	size_t length = 1;
+	for (uint32_t i = s; swc.child_offsets[i + 1] - swc.child_offsets[i] == 1;
+			i = swc.children[swc.child_offsets[i]]) {
+		++length;
+	}
+	branch.points.reserve(branch.points.size() + length);
+	branch.points.push_back(swc_point(swc, s));
+	while (swc.child_offsets[s + 1] - swc.child_offsets[s] == 1) {
+		s = swc.children[swc.child_offsets[s]];
+		branch.points.push_back(swc_point(swc, s));
+	}
+
+	const uint32_t begin = swc.child_offsets[s];
+	const uint32_t end = swc.child_offsets[s + 1];
+	if (end - begin > 1) {
+		branch.branches.resize(end - begin);
+		// Pushed in reverse so the branches are filled in order
+		for (uint32_t c = end; c-- > begin;) {
+			Branch &b = branch.branches[c - begin];
+			b.leaf = "Normal";
+			stack.push_back(std::make_pair(&b, swc.children[c]));
+		}
+	}
+}
+
+}
+
+NeuronData convert_swc(const SWCData &swc) {
+	NeuronData data;
+	data.trees.resize(swc.roots.size());
+	std::vector<std::pair<Branch*, uint32_t>> stack;
+	for (size_t i = 0; i < swc.roots.size(); ++i) {
+		const uint32_t root = swc.roots[i];
+		Tree &t = data.trees[i];
+		t.color = Color(1, 1, 1);
+		t.type = swc_type_name(swc.types[root]);
+		t.leaf = "Normal";
+		convert_run(t, root, swc, stack);
+		while (!stack.empty()) {
+			const auto next = stack.back();
+			stack.pop_back();
+			convert_run(*next.first, next.second, swc, stack);
+		}
+	}
+	return data;
+}
+
+NeuronData import_swc(const std::string &fname) {
+	return convert_swc(read_swc(fname));
+}
+
+namespace {
+
+class SWCWriter {
+	detail::OutputBuffer &out;
+	const SWCExportOptions &options;
+	ExportOptions float_options;
+	int64_t next_id;
+
+public:
+	SWCWriter(detail::OutputBuffer &out, const SWCExportOptions &options)
+		: out(out), options(options), next_id(1)
+	{
+		float_options.float_format = options.float_format;
+		float_options.precision = options.precision;
+	}
+
+	void comment(const std::string &text) {
+		size_t start = 0;
+		while (start < text.size()) {
+			size_t end = text.find('\n', start);
+			if (end == std::string::npos) {
+				end = text.size();
+			}
+			out.write("# ", 2);
+			out.write(text.data() + start, end - start);
+			out.put('\n');
+			start = end + 1;
+		}
+	}
+
+	// Write the points of the branch, returning the id of its last point or
+	// parent if it has no points
+	template<typename B>
+	int64_t branch(const B &b, int64_t parent, int32_t type) {
+		for (size_t i = 0; i < b.points.size(); ++i) {
+			const bool last = i + 1 == b.points.size();
+			parent = sample(b.points[i], code(type, parent, last, !b.branches.empty()), parent);
+		}
+		return parent;
+	}
+
+	// The type code written for a point of a tree of this type
+	int32_t code(int32_t type, int64_t parent, bool last, bool forks) const {
+		if (!options.structure_codes) {
+			return type;
+		}
+		if (parent == -1) {
+			return 1;
+		}
+		if (last) {
+			return forks ? 5 : 6;
+		}
+		return 0;
+	}
+
+	// Write a sample, returning its id
+	int64_t sample(const Point &p, int32_t type, int64_t parent) {
+		const int64_t id = next_id++;
+		// id, type and parent take at most 20 chars each
+		char *buf = out.reserve(3 * 21 + 4 * (detail::MAX_FLOAT_CHARS + 1) + 1);
+		char *c = buf;
+		c += detail::format_int(id, c);
+		*c++ = ' ';
+		c += detail::format_int(type, c);
+		*c++ = ' ';
+		c += detail::format_float(p.x, float_options, c);
+		*c++ = ' ';
+		c += detail::format_float(p.y, float_options, c);
+		*c++ = ' ';
+		c += detail::format_float(p.z, float_options, c);
+		*c++ = ' ';
+		c += detail::format_float(p.d / 2.f, float_options, c);
+		*c++ = ' ';
+		c += detail::format_int(parent, c);
+		*c++ = '\n';
+		out.commit(c - buf);
+		return id;
+	}
+};
+
+void write_swc(const NeuronData &data, detail::OutputBuffer &out, const SWCExportOptions &options) {
+	SWCWriter w(out, options);
+	if (!options.comment.empty()) {
+		w.comment(options.comment);
+	}
+	// Branches are written depth first, each parented to the last point of
+	// the branch it comes off
+	std::vector<std::pair<const Branch*, int64_t>> stack;
+	for (const auto &t : data.trees) {
+		const int32_t type = swc_type_code(t.type);
+		const int64_t last = w.branch(t, -1, type);
+		for (auto b = t.branches.rbegin(); b != t.branches.rend(); ++b) {
+			stack.push_back(std::make_pair(&*b, last));
+		}
+		while (!stack.empty()) {
+			const auto next = stack.back();
+			stack.pop_back();
+			const int64_t branch_last = w.branch(*next.first, next.second, type);
+			for (auto b = next.first->branches.rbegin(); b != next.first->branches.rend(); ++b) {
+				stack.push_back(std::make_pair(&*b, branch_last));
+			}
+		}
+	}
+	out.flush();
+}
+
+}
+
+struct SWCStreamWriter::State {
+	SWCExportOptions options;
+	detail::OutputBuffer out;
+	SWCWriter writer;
+	bool transform;
+	float matrix[16];
+	int32_t type;
+	// The id the next point of each open tree or branch is parented to
+	std::vector<int64_t> parents;
+	// The last point is held back until it's known if it ends its branch
+	bool pending;
+	Point pending_point;
+	// Depth of contours and markers being skipped
+	size_t skip;
+
+	State(std::ostream &os, const SWCExportOptions &options)
+		: options(options), out(os), writer(out, this->options), transform(false), type(0),
+		pending(false), skip(0)
+	{}
+	State(int fd, const SWCExportOptions &options)
+		: options(options), out(fd), writer(out, this->options), transform(false), type(0),
+		pending(false), skip(0)
+	{}
+	State(std::FILE *file, const SWCExportOptions &options)
+		: options(options), out(file), writer(out, this->options), transform(false), type(0),
+		pending(false), skip(0)
+	{}
+
+	// Write the held back point, with last and forks telling if it's the last
+	// point of its branch and if branches come off it
+	void write_pending(bool last, bool forks) {
+		if (!pending) {
+			return;
+		}
+		pending = false;
+		int64_t &parent = parents.back();
+		parent = writer.sample(pending_point, writer.code(type, parent, last, forks), parent);
+	}
+};
+
+SWCStreamWriter::SWCStreamWriter(std::ostream &os, const SWCExportOptions &options)
+	: state(new State(os, options))
+{
+	if (!options.comment.empty()) {
+		state->writer.comment(options.comment);
+	}
+}
+SWCStreamWriter::SWCStreamWriter(int fd, const SWCExportOptions &options)
+	: state(new State(fd, options))
+{
+	if (!options.comment.empty()) {
+		state->writer.comment(options.comment);
+	}
+}
+SWCStreamWriter::SWCStreamWriter(std::FILE *file, const SWCExportOptions &options)
+	: state(new State(file, options))
+{
+	if (!options.comment.empty()) {
+		state->writer.comment(options.comment);
+	}
+}
+SWCStreamWriter::~SWCStreamWriter() {}
+void SWCStreamWriter::set_transform(const float matrix[16]) {
+	state->transform = true;
+	std::copy(matrix, matrix + 16, state->matrix);
+}
+void SWCStreamWriter::finish() {
+	state->out.flush();
+}
+void SWCStreamWriter::begin_tree(const Tree &tree) {
+	state->type = swc_type_code(tree.type);
+	state->parents.push_back(-1);
+}
+void SWCStreamWriter::end_tree() {
+	state->write_pending(true, false);
+	state->parents.pop_back();
+}
+void SWCStreamWriter::begin_branch(const std::string &) {
+	state->write_pending(true, true);
+	state->parents.push_back(state->parents.back());
+}
+void SWCStreamWriter::end_branch() {
+	state->write_pending(true, false);
+	state->parents.pop_back();
+}
+void SWCStreamWriter::begin_contour(const Contour &) {
+	++state->skip;
+}
+void SWCStreamWriter::end_contour() {
+	--state->skip;
+}
+void SWCStreamWriter::begin_marker(const Marker &) {
+	++state->skip;
+}
+void SWCStreamWriter::end_marker() {
+	--state->skip;
+}
+void SWCStreamWriter::point(const Point &p) {
+	if (state->skip != 0 || state->parents.empty()) {
+		return;
+	}
+	state->write_pending(false, false);
+	Point &q = state->pending_point;
+	q = p;
+	if (state->transform) {
+		detail::transform_points(&q, 1, state->matrix);
+	}
+	state->pending = true;
+}
+
+void export_swc(const NeuronData &data, const std::string &fname, const SWCExportOptions &options) {
+	std::ofstream fout(fname.c_str());
+	if (!fout) {
+		throw std::runtime_error("Error: failed to open " + fname + " for writing");
+	}
+	export_swc_stream(data, fout, options);
+}
+void export_swc_stream(const NeuronData &data, std::ostream &os, const SWCExportOptions &options) {
+	detail::OutputBuffer out(os);
+	write_swc(data, out, options);
+	os.flush();
+}
+void export_swc_fd(const NeuronData &data, int fd, const SWCExportOptions &options) {
+	detail::OutputBuffer out(fd);
+	write_swc(data, out, options);
+}
+void export_swc_file(const NeuronData &data, std::FILE *file, const SWCExportOptions &options) {
+	detail::OutputBuffer out(file);
+	write_swc(data, out, options);
+}
+
+}
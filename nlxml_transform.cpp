@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <vector>
+#include "nlxml_parallel.h"
+#include "nlxml_transform.h"
+#include "nlxml.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define NLXML_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NLXML_SSE2 1
+#endif
+
+/* The kernels compute each coordinate as ((m0 * x + m4 * y) + m8 * z) + m12,
+ * the same operations in the same order in the scalar, SSE2 and AVX paths so
+ * they give identical results. This isn't the order glm 0.9.9 and later use
+ * for mat4 * vec4, so coordinates can differ in the last bit from the older
+ * glm based utilities. AVX is used when the library is built with it enabled
+ * (see NLXML_ENABLE_AVX), SSE2 is always available on x86-64.
+ */
+namespace nlxml {
+namespace detail {
+
+namespace {
+
+inline void transform_point(Point &p, const float *m) {
+	const float x = p.x;
+	const float y = p.y;
+	const float z = p.z;
+	p.x = m[0] * x + m[4] * y + m[8] * z + m[12];
+	p.y = m[1] * x + m[5] * y + m[9] * z + m[13];
+	p.z = m[2] * x + m[6] * y + m[10] * z + m[14];
+}
+
+}
+
+void transform_points(Point *points, size_t count, const float m[16]) {
+	static_assert(sizeof(Point) == 4 * sizeof(float), "Point must be 4 packed floats");
+	float *f = &points[0].x;
+	size_t i = 0;
+#if NLXML_AVX
+	{
+		// Two points per register, with the columns repeated in each half
+		const __m256 c0 = _mm256_setr_ps(m[0], m[1], m[2], 0, m[0], m[1], m[2], 0);
+		const __m256 c1 = _mm256_setr_ps(m[4], m[5], m[6], 0, m[4], m[5], m[6], 0);
+		const __m256 c2 = _mm256_setr_ps(m[8], m[9], m[10], 0, m[8], m[9], m[10], 0);
+		const __m256 c3 = _mm256_setr_ps(m[12], m[13], m[14], 0, m[12], m[13], m[14], 0);
+		for (; i + 2 <= count; i += 2) {
+			const __m256 p = _mm256_loadu_ps(f + 4 * i);
+			const __m256 x = _mm256_permute_ps(p, 0x00);
+			const __m256 y = _mm256_permute_ps(p, 0x55);
+			const __m256 z = _mm256_permute_ps(p, 0xaa);
+			__m256 r = _mm256_add_ps(_mm256_mul_ps(c0, x), _mm256_mul_ps(c1, y));
+			r = _mm256_add_ps(r, _mm256_mul_ps(c2, z));
+			r = _mm256_add_ps(r, c3);
+			_mm256_storeu_ps(f + 4 * i, _mm256_blend_ps(r, p, 0x88));
+		}
+	}
+#endif
+#if NLXML_SSE2
+	{
+		const __m128 c0 = _mm_setr_ps(m[0], m[1], m[2], 0);
+		const __m128 c1 = _mm_setr_ps(m[4], m[5], m[6], 0);
+		const __m128 c2 = _mm_setr_ps(m[8], m[9], m[10], 0);
+		const __m128 c3 = _mm_setr_ps(m[12], m[13], m[14], 0);
+		const __m128 keep_d = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+		for (; i < count; ++i) {
+			const __m128 p = _mm_loadu_ps(f + 4 * i);
+			const __m128 x = _mm_shuffle_ps(p, p, 0x00);
+			const __m128 y = _mm_shuffle_ps(p, p, 0x55);
+			const __m128 z = _mm_shuffle_ps(p, p, 0xaa);
+			__m128 r = _mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c1, y));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, z));
+			r = _mm_add_ps(r, c3);
+			r = _mm_or_ps(_mm_andnot_ps(keep_d, r), _mm_and_ps(keep_d, p));
+			_mm_storeu_ps(f + 4 * i, r);
+		}
+	}
+#endif
+	for (; i < count; ++i) {
+		transform_point(points[i], m);
+	}
+}
+
+void transform_points(float *xs, float *ys, float *zs, size_t count, const float m[16]) {
+	size_t i = 0;
+#if NLXML_AVX
+	{
+		__m256 c[12];
+		for (size_t j = 0; j < 12; ++j) {
+			c[j] = _mm256_set1_ps(m[j + j / 3]);
+		}
+		for (; i + 8 <= count; i += 8) {
+			const __m256 x = _mm256_loadu_ps(xs + i);
+			const __m256 y = _mm256_loadu_ps(ys + i);
+			const __m256 z = _mm256_loadu_ps(zs + i);
+			const __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(c[0], x), _mm256_mul_ps(c[3], y)), _mm256_mul_ps(c[6], z)), c[9]);
+			const __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(c[1], x), _mm256_mul_ps(c[4], y)), _mm256_mul_ps(c[7], z)), c[10]);
+			const __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(c[2], x), _mm256_mul_ps(c[5], y)), _mm256_mul_ps(c[8], z)), c[11]);
+			_mm256_storeu_ps(xs + i, rx);
+			_mm256_storeu_ps(ys + i, ry);
+			_mm256_storeu_ps(zs + i, rz);
+		}
+	}
+#endif
+#if NLXML_SSE2
+	{
+		__m128 c[12];
+		for (size_t j = 0; j < 12; ++j) {
+			c[j] = _mm_set1_ps(m[j + j / 3]);
+		}
+		for (; i + 4 <= count; i += 4) {
+			const __m128 x = _mm_loadu_ps(xs + i);
+			const __m128 y = _mm_loadu_ps(ys + i);
+			const __m128 z = _mm_loadu_ps(zs + i);
+			const __m128 rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(c[0], x), _mm_mul_ps(c[3], y)), _mm_mul_ps(c[6], z)), c[9]);
+			const __m128 ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(c[1], x), _mm_mul_ps(c[4], y)), _mm_mul_ps(c[7], z)), c[10]);
+			const __m128 rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(c[2], x), _mm_mul_ps(c[5], y)), _mm_mul_ps(c[8], z)), c[11]);
+			_mm_storeu_ps(xs + i, rx);
+			_mm_storeu_ps(ys + i, ry);
+			_mm_storeu_ps(zs + i, rz);
+		}
+	}
+#endif
+	for (; i < count; ++i) {
+		Point p(xs[i], ys[i], zs[i]);
+		transform_point(p, m);
+		xs[i] = p.x;
+		ys[i] = p.y;
+		zs[i] = p.z;
+	}
+}
+
+void multiply(const float a[16], const float b[16], float out[16]) {
+	for (size_t c = 0; c < 4; ++c) {
+		for (size_t r = 0; r < 4; ++r) {
+			float sum = 0;
+			for (size_t k = 0; k < 4; ++k) {
+				sum += a[k * 4 + r] * b[c * 4 + k];
+			}
+			out[c * 4 + r] = sum;
+		}
+	}
+}
+
+void image_matrix(const Image &image, bool inverse, float out[16]) {
+	std::fill(out, out + 16, 0.f);
+	const float scale[3] = {image.scale[0], image.scale[1], image.z_spacing};
+	for (size_t i = 0; i < 3; ++i) {
+		if (inverse) {
+			out[i * 5] = 1.f / scale[i];
+			out[12 + i] = -image.coord[i] / scale[i];
+		} else {
+			out[i * 5] = scale[i];
+			out[12 + i] = image.coord[i];
+		}
+	}
+	out[15] = 1.f;
+}
+
+}
+
+namespace {
+
+// Points per task when transforming on several threads, small arrays are
+// grouped and large ones split to keep the tasks about even
+const size_t CHUNK_POINTS = 1 << 16;
+
+struct PointSpan {
+	Point *points;
+	size_t count;
+};
+
+// Call f with each point array in the data
+template<typename F>
+void for_each_points(NeuronData &data, const F &f) {
+	auto markers = [&](std::vector<Marker> &ms) {
+		for (auto &m : ms) {
+			f(m.points);
+		}
+	};
+	std::vector<Branch*> stack;
+	for (auto &t : data.trees) {
+		f(t.points);
+		markers(t.markers);
+		for (auto &b : t.branches) {
+			stack.push_back(&b);
+		}
+		while (!stack.empty()) {
+			Branch *b = stack.back();
+			stack.pop_back();
+			f(b->points);
+			markers(b->markers);
+			for (auto &c : b->branches) {
+				stack.push_back(&c);
+			}
+		}
+	}
+	for (auto &c : data.contours) {
+		f(c.points);
+		markers(c.markers);
+	}
+	markers(data.markers);
+}
+
+}
+
+void transform(NeuronData &data, const float matrix[16], size_t num_threads) {
+	if (detail::resolve_threads(num_threads) == 1) {
+		for_each_points(data, [&](std::vector<Point> &points) {
+			detail::transform_points(points.data(), points.size(), matrix);
+		});
+		return;
+	}
+
+	// Each point is transformed independently so the order the tasks run in
+	// doesn't change the result, which is the same as the serial path
+	std::vector<PointSpan> spans;
+	std::vector<size_t> task_starts;
+	size_t task_points = CHUNK_POINTS;
+	for_each_points(data, [&](std::vector<Point> &points) {
+		for (size_t i = 0; i < points.size(); i += CHUNK_POINTS) {
+			const size_t count = std::min(CHUNK_POINTS, points.size() - i);
+			if (task_points + count > CHUNK_POINTS) {
+				task_starts.push_back(spans.size());
+				task_points = 0;
+			}
+			spans.push_back(PointSpan{points.data() + i, count});
+			task_points += count;
+		}
+	});
+	task_starts.push_back(spans.size());
+	detail::parallel_for(task_starts.size() - 1, num_threads, [&](size_t t) {
+		for (size_t i = task_starts[t]; i < task_starts[t + 1]; ++i) {
+			detail::transform_points(spans[i].points, spans[i].count, matrix);
+		}
+	});
+}
+
+void transform(FlatNeuronData &data, const float matrix[16], size_t num_threads) {
+	const size_t count = data.x.size();
+	const size_t num_chunks = (count + CHUNK_POINTS - 1) / CHUNK_POINTS;
+	detail::parallel_for(num_chunks, num_threads, [&](size_t c) {
+		const size_t start = c * CHUNK_POINTS;
+		const size_t n = std::min(CHUNK_POINTS, count - start);
+		detail::transform_points(data.x.data() + start, data.y.data() + start,
+				data.z.data() + start, n, matrix);
+	});
+}
+
+}
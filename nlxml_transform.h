@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include "nlxml.h"
+
+// Internal point transform kernels, not installed with the library
+namespace nlxml {
+namespace detail {
+
+// Transform the points in place by the column major affine matrix, the
+// diameters are kept
+void transform_points(Point *points, size_t count, const float matrix[16]);
+
+// Transform the coordinate arrays in place by the column major affine matrix
+void transform_points(float *x, float *y, float *z, size_t count, const float matrix[16]);
+
+// out = a * b for column major 4x4 matrices, out may not alias a or b
+void multiply(const float a[16], const float b[16], float out[16]);
+
+// The image transform translate(coord) * scale(scale[0], scale[1], z_spacing)
+// of the image, or its inverse
+void image_matrix(const Image &image, bool inverse, float out[16]);
+
+}
+}
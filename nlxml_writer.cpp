@@ -0,0 +1,585 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include "nlxml_writer.h"
+#include "nlxml_reader.h"
+#include "nlxml.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace nlxml {
+namespace detail {
+
+OutputBuffer::OutputBuffer(std::ostream &os, size_t size)
+	: buf(size), used(0), os(&os), file(nullptr), fd(-1)
+{}
+OutputBuffer::OutputBuffer(std::FILE *file, size_t size)
+	: buf(size), used(0), os(nullptr), file(file), fd(-1)
+{}
+OutputBuffer::OutputBuffer(int fd, size_t size)
+	: buf(size), used(0), os(nullptr), file(nullptr), fd(fd)
+{}
+void OutputBuffer::write(const char *s, size_t n) {
+	while (n > 0) {
+		if (used == buf.size()) {
+			flush();
+		}
+		const size_t count = std::min(n, buf.size() - used);
+		std::memcpy(buf.data() + used, s, count);
+		used += count;
+		s += count;
+		n -= count;
+	}
+}
+void OutputBuffer::flush() {
+	if (os) {
+		os->write(buf.data(), used);
+		if (!*os) {
+			throw std::runtime_error("Error: failed to write output stream");
+		}
+	} else if (file) {
+		if (std::fwrite(buf.data(), 1, used, file) != used || std::fflush(file) != 0) {
+			throw std::runtime_error("Error: failed to write output file");
+		}
+	} else {
+		const char *p = buf.data();
+		size_t remaining = used;
+		while (remaining > 0) {
+#ifdef _WIN32
+			const int n = _write(fd, p, static_cast<unsigned>(std::min(remaining, size_t(1) << 30)));
+#else
+			const ssize_t n = ::write(fd, p, remaining);
+#endif
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw std::runtime_error("Error: failed to write file descriptor "
+						+ std::to_string(fd));
+			}
+			p += n;
+			remaining -= static_cast<size_t>(n);
+		}
+	}
+	used = 0;
+}
+
+namespace {
+
+// Powers of ten from 1e-45 to 1e53, enough to scale any float to 9 digits
+const int MIN_POW10 = -45;
+const double POW10[] = {
+	1e-45, 1e-44, 1e-43, 1e-42, 1e-41, 1e-40, 1e-39, 1e-38,
+	1e-37, 1e-36, 1e-35, 1e-34, 1e-33, 1e-32, 1e-31, 1e-30,
+	1e-29, 1e-28, 1e-27, 1e-26, 1e-25, 1e-24, 1e-23, 1e-22,
+	1e-21, 1e-20, 1e-19, 1e-18, 1e-17, 1e-16, 1e-15, 1e-14,
+	1e-13, 1e-12, 1e-11, 1e-10, 1e-9, 1e-8, 1e-7, 1e-6,
+	1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2,
+	1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+	1e19, 1e20, 1e21, 1e22, 1e23, 1e24, 1e25, 1e26,
+	1e27, 1e28, 1e29, 1e30, 1e31, 1e32, 1e33, 1e34,
+	1e35, 1e36, 1e37, 1e38, 1e39, 1e40, 1e41, 1e42,
+	1e43, 1e44, 1e45, 1e46, 1e47, 1e48, 1e49, 1e50,
+	1e51, 1e52, 1e53
+};
+
+double pow10(int e) {
+	return POW10[e - MIN_POW10];
+}
+// 2^e for e in the range of normal doubles
+double pow2(int e) {
+	const uint64_t bits = static_cast<uint64_t>(e + 1023) << 52;
+	double d;
+	std::memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+// Write the digits of n, which must be non-zero, returning the count
+size_t write_digits(uint64_t n, char *out) {
+	char tmp[20];
+	size_t len = 0;
+	for (; n > 0; n /= 10) {
+		tmp[len++] = static_cast<char>('0' + n % 10);
+	}
+	for (size_t i = 0; i < len; ++i) {
+		out[i] = tmp[len - 1 - i];
+	}
+	return len;
+}
+
+/* Write the decimal digits * 10^exp, where digits is non-zero. Numbers
+ * with small exponents are written in fixed notation and others in
+ * scientific, as %g does
+ */
+size_t write_decimal(uint64_t digits, int exp, char *out) {
+	while (digits % 10 == 0) {
+		digits /= 10;
+		++exp;
+	}
+	char d[20] = {};
+	const int n = static_cast<int>(write_digits(digits, d));
+	// The exponent of the first digit
+	const int exp10 = exp + n - 1;
+	char *p = out;
+	if (exp10 < -4 || exp10 > 8) {
+		*p++ = d[0];
+		if (n > 1) {
+			*p++ = '.';
+			std::memcpy(p, d + 1, n - 1);
+			p += n - 1;
+		}
+		*p++ = 'e';
+		*p++ = exp10 < 0 ? '-' : '+';
+		const int e = std::abs(exp10);
+		if (e < 10) {
+			*p++ = '0';
+		}
+		p += write_digits(e, p);
+	} else if (exp10 < 0) {
+		*p++ = '0';
+		*p++ = '.';
+		for (int i = 0; i < -exp10 - 1; ++i) {
+			*p++ = '0';
+		}
+		std::memcpy(p, d, n);
+		p += n;
+	} else {
+		for (int i = 0; i <= exp10; ++i) {
+			*p++ = i < n ? d[i] : '0';
+		}
+		if (n > exp10 + 1) {
+			*p++ = '.';
+			std::memcpy(p, d + exp10 + 1, n - exp10 - 1);
+			p += n - exp10 - 1;
+		}
+	}
+	return p - out;
+}
+
+/* Find the shortest decimal which reads back as value, a positive finite
+ * float. The candidates with p significant digits are the p digit decimal
+ * nearest to value and the ones either side of it, the first of them
+ * inside the interval of reals which round to value is taken. The nearest
+ * is usually the only one which can be, but at a power of two the float
+ * below is half as far away as the one above, so the interval is lopsided
+ * and the next decimal up can be inside it when the nearest isn't. The test
+ * is done in doubles, where the scaling error is ~2^-52 against an interval
+ * at least 2^-25 wide relative to value, so only candidates right at the
+ * boundaries need to be parsed back to check them. 9 digits always
+ * round-trip, so the search ends there.
+ */
+size_t format_shortest(float value, char *out) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const int biased_exp = static_cast<int>(bits >> 23);
+	const uint32_t mantissa = bits & 0x7FFFFF;
+	const int ulp_exp = biased_exp == 0 ? -149 : biased_exp - 150;
+
+	const double v = value;
+	const double half_ulp = pow2(ulp_exp - 1);
+	const double hi = v + half_ulp;
+	// The float below a power of two is half as far away
+	const double lo = mantissa == 0 && biased_exp > 1 ? v - half_ulp / 2 : v - half_ulp;
+
+	// Estimate the decimal exponent from the binary one, which can be low by 1
+	int exp2 = biased_exp - 127;
+	if (biased_exp == 0) {
+		std::frexp(v, &exp2);
+		--exp2;
+	}
+	int exp10 = static_cast<int>(std::floor(exp2 * 0.30102999566398120));
+	if (v >= pow10(exp10 + 1)) {
+		++exp10;
+	}
+
+	for (int p = 1; p < 9; ++p) {
+		const double scale = pow10(p - 1 - exp10);
+		const double s = v * scale;
+		const double nearest = static_cast<double>(static_cast<uint64_t>(s + 0.5));
+		const double margin = s * pow2(-45);
+		const double lo_s = lo * scale;
+		const double hi_s = hi * scale;
+		const double candidates[] = {nearest, nearest - 1, nearest + 1};
+		for (const double c : candidates) {
+			if (c < 1) {
+				continue;
+			}
+			if (c > lo_s + margin && c < hi_s - margin) {
+				return write_decimal(static_cast<uint64_t>(c), exp10 - p + 1, out);
+			}
+			if (c > lo_s - margin && c < hi_s + margin) {
+				const size_t len = write_decimal(static_cast<uint64_t>(c), exp10 - p + 1, out);
+				float parsed;
+				if (parse_float(out, out + len, &parsed) && parsed == value) {
+					return len;
+				}
+			}
+		}
+	}
+	return write_decimal(static_cast<uint64_t>(v * pow10(8 - exp10) + 0.5), exp10 - 8, out);
+}
+
+/* Round value to the given number of decimal places. Scaling a float by
+ * up to 10^9 is exact in a double, so rounding the product half to even
+ * gives the same digits as printf's %.*f.
+ */
+size_t format_fixed(float value, int precision, char *out) {
+	const double scaled = std::nearbyint(std::abs(static_cast<double>(value)) * pow10(precision));
+	if (scaled == 0) {
+		out[0] = '0';
+		return 1;
+	}
+	char *p = out;
+	if (value < 0) {
+		*p++ = '-';
+	}
+	// Too large to have any decimal places
+	if (scaled >= pow2(62)) {
+		return p - out + format_shortest(std::abs(value), p);
+	}
+	const uint64_t n = static_cast<uint64_t>(scaled);
+	const uint64_t unit = static_cast<uint64_t>(pow10(precision));
+	const uint64_t integer = n / unit;
+	uint64_t fraction = n % unit;
+	if (integer == 0) {
+		*p++ = '0';
+	} else {
+		p += write_digits(integer, p);
+	}
+	if (fraction != 0) {
+		int places = precision;
+		while (fraction % 10 == 0) {
+			fraction /= 10;
+			--places;
+		}
+		*p++ = '.';
+		for (int i = places - 1; i >= 0; --i, fraction /= 10) {
+			p[i] = static_cast<char>('0' + fraction % 10);
+		}
+		p += places;
+	}
+	return p - out;
+}
+
+}
+
+size_t format_int(int64_t value, char *out) {
+	char *p = out;
+	uint64_t n = static_cast<uint64_t>(value);
+	if (value < 0) {
+		*p++ = '-';
+		n = 0 - n;
+	}
+	if (n == 0) {
+		*p++ = '0';
+		return p - out;
+	}
+	return p - out + write_digits(n, p);
+}
+size_t format_float(float value, const ExportOptions &options, char *out) {
+	if (options.float_format == FloatFormat::COMPATIBLE || !std::isfinite(value)) {
+		return std::snprintf(out, MAX_FLOAT_CHARS, "%.8g", value);
+	}
+	if (options.float_format == FloatFormat::FIXED) {
+		if (options.precision < 0 || options.precision > 9) {
+			throw std::runtime_error("Error: fixed float precision must be from 0 to 9, got "
+					+ std::to_string(options.precision));
+		}
+		return format_fixed(value, options.precision, out);
+	}
+	char *p = out;
+	if (std::signbit(value)) {
+		*p++ = '-';
+	}
+	if (value == 0) {
+		*p++ = '0';
+		return p - out;
+	}
+	return p - out + format_shortest(std::abs(value), p);
+}
+
+}
+
+namespace {
+
+using namespace detail;
+
+/* Writes NLXML in exactly the layout tinyxml2's XMLPrinter produces for the
+ * DOM export_file used to build: elements indented by 4 spaces per level,
+ * empty elements closed with "/>" and text elements kept on one line.
+ */
+class XMLWriter {
+	OutputBuffer &out;
+	const ExportOptions &options;
+	int depth;
+	// Set while the start tag of the innermost element is still open
+	bool just_opened;
+	bool has_text;
+
+public:
+	XMLWriter(OutputBuffer &out, const ExportOptions &options)
+		: out(out), options(options), depth(0), just_opened(false), has_text(false) {
+		out.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+	}
+
+	void open_element(const char *name) {
+		seal();
+		out.put('\n');
+		indent(depth);
+		out.put('<');
+		out.write(name);
+		just_opened = true;
+		++depth;
+	}
+	void close_element(const char *name) {
+		--depth;
+		if (just_opened) {
+			out.write("/>", 2);
+		} else {
+			if (!has_text) {
+				out.put('\n');
+				indent(depth);
+			}
+			out.write("</", 2);
+			out.write(name);
+			out.put('>');
+		}
+		if (depth == 0) {
+			out.put('\n');
+		}
+		just_opened = false;
+		has_text = false;
+	}
+	void attribute(const char *name, const std::string &value) {
+		begin_attribute(name);
+		escape(value.c_str(), false);
+		out.put('"');
+	}
+	void attribute(const char *name, const char *value) {
+		begin_attribute(name);
+		escape(value, false);
+		out.put('"');
+	}
+	void attribute(const char *name, float value) {
+		begin_attribute(name);
+		write_float(value);
+		out.put('"');
+	}
+	void attribute(const char *name, int value) {
+		begin_attribute(name);
+		char *p = out.reserve(16);
+		out.commit(std::snprintf(p, 16, "%d", value));
+		out.put('"');
+	}
+	void attribute(const char *name, bool value) {
+		attribute(name, value ? "true" : "false");
+	}
+	void attribute(const char *name, const Color &c) {
+		begin_attribute(name);
+		char *p = out.reserve(8);
+		out.commit(std::snprintf(p, 8, "#%02X%02X%02X", static_cast<uint8_t>(c.r*255),
+				static_cast<uint8_t>(c.g*255), static_cast<uint8_t>(c.b*255)));
+		out.put('"');
+	}
+	void text(const std::string &value) {
+		seal();
+		has_text = true;
+		escape(value.c_str(), true);
+	}
+
+	// Points make up most of the output so get their own fast path
+	void point(const Point &p) {
+		seal();
+		out.put('\n');
+		indent(depth);
+		out.write("<point", 6);
+		attribute("x", p.x);
+		attribute("y", p.y);
+		attribute("z", p.z);
+		attribute("d", p.d);
+		out.write("/>", 2);
+	}
+
+private:
+	void seal() {
+		if (just_opened) {
+			out.put('>');
+			just_opened = false;
+		}
+	}
+	void indent(int n) {
+		for (int i = 0; i < n; ++i) {
+			out.write("    ", 4);
+		}
+	}
+	void begin_attribute(const char *name) {
+		out.put(' ');
+		out.write(name);
+		out.write("=\"", 2);
+	}
+	void write_float(float value) {
+		out.commit(format_float(value, options, out.reserve(MAX_FLOAT_CHARS)));
+	}
+	// Escape the string as XMLPrinter does, attributes also escape quotes
+	void escape(const char *s, bool text) {
+		const char *run = s;
+		for (; *s; ++s) {
+			const char *entity = nullptr;
+			switch (*s) {
+				case '&': entity = "&amp;"; break;
+				case '<': entity = "&lt;"; break;
+				case '>': entity = "&gt;"; break;
+				case '"': entity = text ? nullptr : "&quot;"; break;
+				case '\'': entity = text ? nullptr : "&apos;"; break;
+				default: break;
+			}
+			if (entity) {
+				out.write(run, s - run);
+				out.write(entity);
+				run = s + 1;
+			}
+		}
+		out.write(run, s - run);
+	}
+};
+
+void write_marker(const Marker &marker, XMLWriter &w) {
+	w.open_element("marker");
+	w.attribute("type", marker.type);
+	w.attribute("name", marker.name);
+	w.attribute("color", marker.color);
+	w.attribute("varicosity", marker.varicosity);
+	for (auto &p : marker.points) {
+		w.point(p);
+	}
+	w.close_element("marker");
+}
+void write_contour(const Contour &contour, XMLWriter &w) {
+	w.open_element("contour");
+	w.attribute("name", contour.name);
+	w.attribute("shape", contour.shape);
+	w.attribute("color", contour.color);
+	w.attribute("closed", contour.closed);
+	for (auto &p : contour.points) {
+		w.point(p);
+	}
+	for (auto &m : contour.markers) {
+		write_marker(m, w);
+	}
+	w.close_element("contour");
+}
+void write_branch(const Branch &branch, XMLWriter &w) {
+	w.open_element("branch");
+	w.attribute("leaf", branch.leaf);
+	for (auto &p : branch.points) {
+		w.point(p);
+	}
+	for (auto &b : branch.branches) {
+		write_branch(b, w);
+	}
+	for (auto &m : branch.markers) {
+		write_marker(m, w);
+	}
+	w.close_element("branch");
+}
+void write_tree(const Tree &tree, XMLWriter &w) {
+	w.open_element("tree");
+	w.attribute("color", tree.color);
+	w.attribute("type", tree.type);
+	w.attribute("leaf", tree.leaf);
+	for (auto &p : tree.points) {
+		w.point(p);
+	}
+	for (auto &b : tree.branches) {
+		write_branch(b, w);
+	}
+	for (auto &m : tree.markers) {
+		write_marker(m, w);
+	}
+	w.close_element("tree");
+}
+void write_image(const Image &image, XMLWriter &w) {
+	w.open_element("image");
+	for (auto &f : image.filenames) {
+		w.open_element("filename");
+		w.text(f);
+		w.close_element("filename");
+	}
+
+	w.open_element("scale");
+	w.attribute("x", image.scale[0]);
+	w.attribute("y", image.scale[1]);
+	w.close_element("scale");
+
+	w.open_element("coord");
+	w.attribute("x", image.coord[0]);
+	w.attribute("y", image.coord[1]);
+	w.attribute("z", image.coord[2]);
+	w.close_element("coord");
+
+	w.open_element("zspacing");
+	w.attribute("z", image.z_spacing);
+	w.attribute("slices", static_cast<int>(image.slices));
+	w.close_element("zspacing");
+
+	w.close_element("image");
+}
+void write_neuron_data(const NeuronData &data, OutputBuffer &out, const ExportOptions &options) {
+	XMLWriter w(out, options);
+
+	// MBF meta information
+	w.open_element("mbf");
+	w.attribute("version", "4.0");
+	w.attribute("xmlns", "http://www.mbfbioscience.com/2007/neurolucida");
+	w.attribute("xmlns:nl", "http://www.mbfbioscience.com/2007/neurolucida");
+
+	if (!data.images.empty()) {
+		w.open_element("images");
+		for (auto &i : data.images) {
+			write_image(i, w);
+		}
+		w.close_element("images");
+	}
+	for (auto &t : data.trees) {
+		write_tree(t, w);
+	}
+	for (auto &c : data.contours) {
+		write_contour(c, w);
+	}
+	for (auto &m : data.markers) {
+		write_marker(m, w);
+	}
+	w.close_element("mbf");
+	out.flush();
+}
+
+}
+
+void export_file(const NeuronData &data, const std::string &fname, const ExportOptions &options) {
+	std::ofstream fout(fname.c_str());
+	if (!fout) {
+		throw std::runtime_error("Error: failed to open " + fname + " for writing");
+	}
+	export_stream(data, fout, options);
+}
+void export_stream(const NeuronData &data, std::ostream &os, const ExportOptions &options) {
+	OutputBuffer out(os);
+	write_neuron_data(data, out, options);
+	os.flush();
+}
+void export_fd(const NeuronData &data, int fd, const ExportOptions &options) {
+	OutputBuffer out(fd);
+	write_neuron_data(data, out, options);
+}
+
+}
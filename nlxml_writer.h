@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "nlxml.h"
+
+// Internal helpers shared by the exporters, not installed with the library
+namespace nlxml {
+namespace detail {
+
+/* A fixed size output buffer which is flushed in large blocks to either a
+ * std::ostream, a C stdio stream or a file descriptor, so the memory used while exporting
+ * doesn't depend on the size of the data being written. Failed writes
+ * throw a std::runtime_error. Any remaining output is written by flush,
+ * which must be called before the buffer is destroyed.
+ */
+class OutputBuffer {
+	std::vector<char> buf;
+	size_t used;
+	std::ostream *os;
+	std::FILE *file;
+	int fd;
+
+public:
+	static const size_t DEFAULT_SIZE = 1 << 20;
+
+	OutputBuffer(std::ostream &os, size_t size = DEFAULT_SIZE);
+	OutputBuffer(std::FILE *file, size_t size = DEFAULT_SIZE);
+	OutputBuffer(int fd, size_t size = DEFAULT_SIZE);
+
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+	// Reserve space for at least n more chars, flushing if needed. n must
+	// be no larger than the buffer size
+	char* reserve(size_t n) {
+		if (buf.size() - used < n) {
+			flush();
+		}
+		return buf.data() + used;
+	}
+	// Mark n chars written at the pointer returned by reserve as used
+	void commit(size_t n) {
+		used += n;
+	}
+	void put(char c) {
+		*reserve(1) = c;
+		++used;
+	}
+	void write(const char *s, size_t n);
+	void write(const char *s) {
+		write(s, std::strlen(s));
+	}
+	void write(const std::string &s) {
+		write(s.data(), s.size());
+	}
+
+	void flush();
+};
+
+// Format the integer to out, which needs room for 20 chars, returning the
+// number of chars written
+size_t format_int(int64_t value, char *out);
+
+// The most chars format_float will write
+const size_t MAX_FLOAT_CHARS = 32;
+
+// Format the float to out as selected by the options, returning the number
+// of chars written. Infinities and NaNs are written as printf does
+size_t format_float(float value, const ExportOptions &options, char *out);
+
+}
+}
+
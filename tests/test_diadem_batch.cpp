@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+/* Check that a batch of DIADEM scores records the files that can't be
+ * imported, whether missing or malformed, next to the scores of the
+ * good files instead of aborting the batch.
+ */
+
+NeuronData make_tracing(float offset) {
+	NeuronData data;
+	Branch left{"Normal", {Point(offset, 10, 0, 1), Point(offset, 20, 0, 1)}, {}, {}};
+	Branch right{"Normal", {Point(offset + 10, 10, 0, 1)}, {}, {}};
+	data.trees.push_back(Tree{Color(1, 0, 0), "Dendrite", "Normal",
+		{Point(offset, 0, 0, 2), Point(offset, 5, 0, 2)}, {left, right}, {}});
+	return data;
+}
+
+int main() {
+	const std::string gold_file = "test_diadem_batch_gold.xml";
+	const std::string good_file = "test_diadem_batch_good.xml";
+	const std::string bad_color_file = "test_diadem_batch_bad_color.xml";
+	const std::string bad_hex_file = "test_diadem_batch_bad_hex.xml";
+	const std::string missing_file = "test_diadem_batch_missing.xml";
+
+	const NeuronData gold = make_tracing(0);
+	export_file(gold, gold_file);
+	export_file(make_tracing(0.5f), good_file);
+	// Colors that aren't #RRGGBB make the color parsing throw exceptions
+	// other than runtime_error
+	std::ofstream(bad_color_file.c_str()) << "<mbf>\n<tree color=\"red\" type=\"Dendrite\" leaf=\"Normal\">\n"
+		<< "<point x=\"0\" y=\"0\" z=\"0\" d=\"1\"/>\n</tree>\n</mbf>\n";
+	std::ofstream(bad_hex_file.c_str()) << "<mbf>\n<tree color=\"#zzzzzz\" type=\"Dendrite\" leaf=\"Normal\">\n"
+		<< "<point x=\"0\" y=\"0\" z=\"0\" d=\"1\"/>\n</tree>\n</mbf>\n";
+	std::remove(missing_file.c_str());
+
+	const std::vector<std::string> fnames = {good_file, bad_color_file, missing_file, bad_hex_file, gold_file};
+	const DiademScorer scorer(gold);
+	const std::vector<DiademBatchEntry> entries = scorer.score_files(fnames, 2);
+
+	int failures = 0;
+	auto check = [&](bool ok, const std::string &what) {
+		if (!ok) {
+			std::cout << "Failed: " << what << "\n";
+			++failures;
+		}
+	};
+	check(entries.size() == fnames.size(), "an entry for each file");
+	for (size_t i = 0; i < entries.size() && i < fnames.size(); ++i) {
+		check(entries[i].fname == fnames[i], "entry " + std::to_string(i) + " is for " + fnames[i]);
+		const bool should_fail = i == 1 || i == 2 || i == 3;
+		check(entries[i].error.empty() != should_fail, fnames[i] + " error is '" + entries[i].error + "'");
+	}
+	if (failures == 0) {
+		check(entries[0].result.score == 1.0, "the shifted tracing matches the gold");
+		check(entries[4].result.score == 1.0, "the gold matches itself");
+		check(entries[4].result.missed.empty() && entries[4].result.extra.empty(),
+				"the gold has no missed or extra nodes");
+	}
+	std::cout << (failures == 0 ? "All checks passed\n" : "Some checks failed\n");
+	return failures == 0 ? 0 : 1;
+}
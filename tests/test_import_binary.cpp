@@ -0,0 +1,92 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+/* Check that importing a binary file with ImportOptions gives the same
+ * result as importing the XML it was saved from with the same options,
+ * for the element selection, tree filter and transforms.
+ */
+
+NeuronData make_data() {
+	NeuronData data;
+	data.images.push_back(Image{{"a.tif"}, {{0.5f, 0.25f}}, {{10.f, 20.f, 30.f}}, 2.f, 10});
+
+	Marker on_branch{"Dot", "branch marker", Color(1, 0, 0), false, {Point(1, 2, 3, 0.5f)}};
+	Branch child{"Normal", {Point(4, 5, 6, 1), Point(7, 8.5f, 9, 1.25f)}, {on_branch}, {}};
+	Branch fork{"Normal", {Point(3, 3, 3, 2)}, {}, {child, child}};
+	Tree dendrite{Color(0, 1, 0), "Dendrite", "Normal", {Point(0, 0, 0, 3), Point(1, 1, 1, 2.5f)},
+		{fork}, {on_branch}};
+	Tree axon{Color(0, 0, 1), "Axon", "Normal", {Point(-1, -2, -3, 1.5f), Point(-4, -5, -6, 1)}, {}, {}};
+	data.trees.push_back(dendrite);
+	data.trees.push_back(axon);
+
+	data.contours.push_back(Contour{"Soma", "Contour", Color(1, 1, 0), true,
+		{Point(0, 1, 0, 0), Point(1, 0, 0, 0), Point(0, -1, 0, 0)}, {on_branch}});
+	data.markers.push_back(Marker{"FilledCircle", "top", Color(1, 1, 1), false,
+		{Point(5, 5, 5, 1), Point(6, 6, 6, 1)}});
+	return data;
+}
+
+std::string to_xml(const NeuronData &data) {
+	ExportOptions options;
+	options.float_format = FloatFormat::SHORTEST;
+	std::ostringstream os;
+	export_stream(data, os, options);
+	return os.str();
+}
+
+int main() {
+	const std::string xml = "test_import_binary.xml";
+	const std::string bin = "test_import_binary.bin";
+	const NeuronData data = make_data();
+	export_file(data, xml);
+	save_binary(data, bin);
+
+	const float matrix[16] = {2, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0.5f, 0, 1, -2, 7, 1};
+	std::vector<std::pair<std::string, ImportOptions>> cases;
+	cases.push_back(std::make_pair("default", ImportOptions()));
+	ImportOptions o;
+	o.contours = false;
+	o.markers = false;
+	cases.push_back(std::make_pair("no contours or markers", o));
+	o = ImportOptions();
+	o.images = false;
+	o.branch_markers = false;
+	cases.push_back(std::make_pair("no images or branch markers", o));
+	o = ImportOptions();
+	o.tree_filter = [](const std::string &type) { return type == "Axon"; };
+	cases.push_back(std::make_pair("tree filter", o));
+	o = ImportOptions();
+	o.matrix.assign(matrix, matrix + 16);
+	cases.push_back(std::make_pair("matrix", o));
+	o.image_transform = ImageTransform::INVERT;
+	cases.push_back(std::make_pair("matrix and inverse image transform", o));
+	o = ImportOptions();
+	o.image_transform = ImageTransform::APPLY;
+	o.images = false;
+	o.num_threads = 2;
+	cases.push_back(std::make_pair("image transform without images", o));
+
+	int failures = 0;
+	for (const auto &c : cases) {
+		std::string from_xml, from_bin;
+		try {
+			from_xml = to_xml(import_file(xml, c.second));
+			from_bin = to_xml(import_file(bin, c.second));
+		} catch (const std::exception &e) {
+			std::cout << c.first << ": " << e.what() << "\n";
+			++failures;
+			continue;
+		}
+		if (from_xml != from_bin) {
+			std::cout << c.first << ": the binary import differs from the XML import\n";
+			++failures;
+		}
+	}
+	std::cout << cases.size() - failures << " of " << cases.size() << " cases passed\n";
+	return failures == 0 ? 0 : 1;
+}
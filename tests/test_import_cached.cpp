@@ -0,0 +1,62 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+/* Check that import_cached notices the file changing right after its cache
+ * was built, within the resolution of the modification times and without
+ * changing the file's size, and that a valid cache is used.
+ */
+
+void write_tracing(const std::string &fname, int x) {
+	std::ofstream(fname.c_str()) << "<mbf>\n<tree color=\"#FF0000\" type=\"Dendrite\" leaf=\"Normal\">\n"
+		<< "<point x=\"" << x << "\" y=\"0\" z=\"0\" d=\"1\"/>\n"
+		<< "<point x=\"" << x << "\" y=\"5\" z=\"0\" d=\"1\"/>\n</tree>\n</mbf>\n";
+}
+
+float first_x(const NeuronData &data) {
+	return data.trees.empty() || data.trees[0].points.empty() ? -1.f : data.trees[0].points[0].x;
+}
+
+int main() {
+	const std::string fname = "test_import_cached.xml";
+	const std::string cache = fname + ".bin";
+	std::remove(cache.c_str());
+
+	int failures = 0;
+	auto check = [&](bool ok, const std::string &what) {
+		if (!ok) {
+			std::cout << "Failed: " << what << "\n";
+			++failures;
+		}
+	};
+	for (int x = 1; x <= 5; ++x) {
+		write_tracing(fname, x);
+		check(first_x(import_cached(fname)) == x, "import " + std::to_string(x) + " after rewriting");
+		check(first_x(import_cached(fname)) == x, "import " + std::to_string(x) + " again");
+		check(is_binary_file(cache), "the cache is written");
+	}
+
+	// A cache built once the file's modification time has passed is used in
+	// place of the file, so mark its points to tell them apart
+	write_tracing(fname, 7);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	FlatNeuronData flat = import_file_flat(fname);
+	flat.x[0] = 8;
+	save_cache(flat, fname);
+	check(first_x(import_cached(fname)) == 8, "the cache is used");
+	std::remove(cache.c_str());
+	check(first_x(import_cached(fname)) == 7, "the missing cache is rebuilt");
+
+	// A binary file saved without a source stamp is never taken as the cache
+	save_binary(flat, cache);
+	check(first_x(import_cached(fname)) == 7, "an unstamped binary file is ignored");
+
+	std::cout << (failures == 0 ? "All checks passed\n" : "Some checks failed\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+/* This program converts an NLXML file to the binary format, which all the
+ * other utilities accept in place of the XML and load much faster. By
+ * default the binary file is written next to the input as <input>.bin,
+ * the sidecar import_cached looks for.
+ *
+ * the -check flag will load the binary file back and compare the load
+ * times with importing the XML
+ */
+int main(int argc, char **argv) {
+	std::string input, output;
+	bool check = false;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-o") == 0) {
+			output = argv[++i];
+		} else if (std::strcmp(argv[i], "-check") == 0) {
+			check = true;
+		} else {
+			input = argv[i];
+		}
+	}
+	if (input.empty()) {
+		std::cout << "Error: an input file is needed.\n"
+			<< "Usage: ./nlxml_cache <input> [-o <output>] [-check]\n";
+		return 1;
+	}
+	// The default output is the sidecar, stamped so import_cached uses it
+	const bool sidecar = output.empty();
+	if (sidecar) {
+		output = input + ".bin";
+	}
+
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	const FlatNeuronData data = import_file_flat(input);
+	const double xml_time = std::chrono::duration<double>(clock::now() - start).count();
+	if (sidecar) {
+		save_cache(data, input);
+	} else {
+		save_binary(data, output);
+	}
+	std::cout << "Wrote " << data.num_points() << " points in " << data.trees.size() << " trees to "
+		<< output << "\n";
+
+	if (check) {
+		start = clock::now();
+		const BinaryNeuronFile file(output);
+		const double map_time = std::chrono::duration<double>(clock::now() - start).count();
+		start = clock::now();
+		const FlatNeuronData loaded = file.flat();
+		const double load_time = std::chrono::duration<double>(clock::now() - start).count();
+		if (loaded.x != data.x || loaded.y != data.y || loaded.z != data.z || loaded.d != data.d
+				|| loaded.branches.size() != data.branches.size()
+				|| loaded.strings != data.strings) {
+			std::cout << "Error: the binary file doesn't match the input\n";
+			return 1;
+		}
+		std::cout << "Import XML: " << xml_time << "s\n"
+			<< "Map binary: " << map_time << "s\n"
+			<< "Copy binary: " << load_time << "s\n";
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+// The file name without its directory or extension
+std::string base_name(const std::string &fname) {
+	const size_t slash = fname.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? fname : fname.substr(slash + 1);
+	const size_t dot = name.rfind('.');
+	return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+// The marker file written for a test, or why it couldn't be written
+struct MarkerFile {
+	std::string fname;
+	std::string error;
+};
+
+// Write the table of scores, returning false if the file can't be written
+bool write_table(const std::string &output, const std::vector<DiademBatchEntry> &entries,
+		const std::vector<MarkerFile> &markers)
+{
+	std::ofstream table(output.c_str());
+	table << "file\tscore\tgold_weight\tmissed_weight\textra_weight\tmissed_nodes\textra_nodes"
+		<< "\tmarkers\terror\n";
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const DiademBatchEntry &e = entries[i];
+		if (!e.error.empty()) {
+			table << e.fname << "\t\t\t\t\t\t\t\t" << e.error << "\n";
+			continue;
+		}
+		const DiademResult &r = e.result;
+		table << e.fname << "\t" << r.score << "\t" << r.gold_weight << "\t" << r.missed_weight
+			<< "\t" << r.extra_weight << "\t" << r.missed.size() << "\t" << r.extra.size()
+			<< "\t" << markers[i].fname << "\t" << markers[i].error << "\n";
+	}
+	table.flush();
+	return static_cast<bool>(table);
+}
+
+/* This program will score many test tracings against one gold standard
+ * NLXML file with the DIADEM metric. The gold is imported and indexed once
+ * and the tests are imported and scored on a pool of threads, writing a
+ * tab separated table with a row per test to the output.
+ *
+ * the tests are given on the command line, or one per line in a file with
+ * -list
+ *
+ * the -markers <dir> flag will also write <dir>/<row>_<test name>.diadem.xml
+ * for each test, with markers at its missed and extra nodes in the gold's
+ * space. The row number keeps tests with the same name in different
+ * directories apart, the table lists the marker file of each test
+ *
+ * the -xy and -z flags set how far in microns a test node may be from a
+ * gold node in the XY plane and along Z to match it
+ */
+int main(int argc, char **argv) {
+	std::string gold_file, output, marker_dir;
+	std::vector<std::string> tests;
+	DiademOptions options;
+	size_t num_threads = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-o") == 0) {
+			output = argv[++i];
+		} else if (std::strcmp(argv[i], "-g") == 0) {
+			gold_file = argv[++i];
+		} else if (std::strcmp(argv[i], "-list") == 0) {
+			std::ifstream list(argv[++i]);
+			if (!list) {
+				std::cout << "Error: failed to open the test list " << argv[i] << "\n";
+				return 1;
+			}
+			std::string line;
+			while (std::getline(list, line)) {
+				if (!line.empty()) {
+					tests.push_back(line);
+				}
+			}
+		} else if (std::strcmp(argv[i], "-markers") == 0) {
+			marker_dir = argv[++i];
+		} else if (std::strcmp(argv[i], "-xy") == 0) {
+			options.xy_threshold = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-z") == 0) {
+			options.z_threshold = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-threads") == 0) {
+			num_threads = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			tests.push_back(argv[i]);
+		}
+	}
+	if (gold_file.empty() || output.empty() || tests.empty()) {
+		std::cout << "Error: a gold file, test files and an output file are needed.\n"
+			<< "Usage: ./nlxml_diadem_batch -g <gold> -o <table> [-list <file>] [test ...]"
+			<< " [-markers <dir>] [-xy <um>] [-z <um>] [-threads <n>]\n"
+			<< "\t-list reads the test files from the file, one per line\n"
+			<< "\t-markers writes the missed and extra nodes of each test to <dir>/<row>_<test name>.diadem.xml\n"
+			<< "\t-threads <n> scores the tests on n threads, all hardware threads by default\n";
+		return 1;
+	}
+
+	const NeuronData gold = import_file(gold_file);
+	const DiademScorer scorer(gold, options);
+	const std::vector<DiademBatchEntry> entries = scorer.score_files(tests, num_threads);
+
+	// Write the scores before the markers so they're kept if writing the
+	// markers goes wrong
+	std::vector<MarkerFile> markers(entries.size());
+	if (!write_table(output, entries, markers)) {
+		std::cout << "Error: failed to write " << output << "\n";
+		return 1;
+	}
+	size_t failed = 0;
+	for (const auto &e : entries) {
+		if (!e.error.empty()) {
+			++failed;
+		}
+	}
+	size_t marker_errors = 0;
+	if (!marker_dir.empty()) {
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (!entries[i].error.empty()) {
+				continue;
+			}
+			const std::string fname = marker_dir + "/" + std::to_string(i + 1) + "_"
+				+ base_name(entries[i].fname) + ".diadem.xml";
+			try {
+				export_file(diadem_markers(entries[i].result, gold.images), fname);
+				markers[i].fname = fname;
+			} catch (const std::exception &e) {
+				markers[i].error = e.what();
+				++marker_errors;
+			}
+		}
+		// Rewrite the table with the marker files and their errors
+		if (!write_table(output, entries, markers)) {
+			std::cout << "Error: failed to write " << output << "\n";
+			return 1;
+		}
+	}
+	std::cout << "Scored " << entries.size() - failed << " of " << entries.size() << " tests\n";
+	if (marker_errors > 0) {
+		std::cout << "Failed to write the markers of " << marker_errors << " tests\n";
+	}
+	return failed == 0 && marker_errors == 0 ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 #include <string>
@@ -11,7 +12,11 @@ using namespace nlxml;
  * of points that the compared tracing missed and generate an NLXML
  * file in the right space with markers placed at missed nodes.
  *
- * To generate pipe the output of the diadem metric to this program
+ * To generate pipe the output of the diadem metric to this program,
+ * or pass the test tracing with -t to score it with the library's
+ * DIADEM metric instead. The -xy and -z flags set how far in microns
+ * a test node may be from a gold node in the XY plane and along Z to
+ * match it when scoring with -t
  */
 std::vector<Point> read_nodes() {
 	std::vector<Point> pts;
@@ -30,22 +35,8 @@ std::vector<Point> read_nodes() {
 	return pts;
 }
 
-int main(int argc, char **argv) {
-	std::string gold_file, output;
-	for (int i = 1; i < argc; ++i) {
-		if (std::strcmp(argv[i], "-o") == 0) {
-			output = argv[++i];
-		} else if (std::strcmp(argv[i], "-g") == 0) {
-			gold_file = argv[++i];
-		}
-	}
-	if (gold_file.empty() || output.empty()) {
-		std::cout << "Error: a gold and output file are needed.\n"
-			<< "Usage: ./nlxml_diadem_missed -g <gold> -o <output>\n";
-		return 1;
-	}
-
-	NeuronData gold = import_file(gold_file);
+// Read the missed and extra nodes from the DIADEM metric's output on stdin
+NeuronData read_diadem_output(const NeuronData &gold) {
 	NeuronData missed;
 	missed.images = gold.images;
 
@@ -63,8 +54,43 @@ int main(int argc, char **argv) {
 			missed.markers.push_back(markers);
 		}
 	}
-	export_file(missed, output);
-	return 0;
+	return missed;
 }
 
+int main(int argc, char **argv) {
+	std::string gold_file, test_file, output;
+	DiademOptions options;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-o") == 0) {
+			output = argv[++i];
+		} else if (std::strcmp(argv[i], "-g") == 0) {
+			gold_file = argv[++i];
+		} else if (std::strcmp(argv[i], "-t") == 0) {
+			test_file = argv[++i];
+		} else if (std::strcmp(argv[i], "-xy") == 0) {
+			options.xy_threshold = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-z") == 0) {
+			options.z_threshold = std::atof(argv[++i]);
+		}
+	}
+	if (gold_file.empty() || output.empty()) {
+		std::cout << "Error: a gold and output file are needed.\n"
+			<< "Usage: ./nlxml_diadem_missed -g <gold> -o <output> [-t <test> [-xy <um>] [-z <um>]]\n"
+			<< "Without -t the DIADEM metric's output is read from stdin\n";
+		return 1;
+	}
+
+	const NeuronData gold = import_file(gold_file);
+	if (test_file.empty()) {
+		export_file(read_diadem_output(gold), output);
+		return 0;
+	}
 
+	const NeuronData test = import_file(test_file);
+	const DiademResult result = diadem_compare(gold, test, options);
+	std::cout << "Found " << result.missed.size() << " missed nodes\n"
+		<< "Found " << result.extra.size() << " extra nodes\n"
+		<< "Score: " << result.score << "\n";
+	export_file(diadem_markers(result, gold.images), output);
+	return 0;
+}
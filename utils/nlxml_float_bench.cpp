@@ -0,0 +1,179 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "tinyxml2.h"
+#include "nlxml_reader.h"
+#include "nlxml_writer.h"
+
+/* This program benchmarks the float parser used for the point attributes
+ * against the sscanf based tinyxml2::XMLUtil::ToFloat it replaced, and
+ * checks that both give bit-identical results. The strings are formatted
+ * like the coordinates and diameters found in NLXML files.
+ *
+ * The export float formats are then timed on the parsed values, checking
+ * that the shortest format reads back to the same floats and that no
+ * decimal with fewer significant digits would. Powers of two and the floats
+ * next to them, where the interval rounding to a float is lopsided, are
+ * checked along with the parsed values.
+ *
+ * Usage: ./nlxml_float_bench [-n <count>] [-seed <seed>]
+ */
+// The number of significant digits in the formatted float
+int significant_digits(const char *s) {
+	std::string digits;
+	for (; *s && *s != 'e'; ++s) {
+		if (*s >= '0' && *s <= '9') {
+			digits += *s;
+		}
+	}
+	const size_t first = digits.find_first_not_of('0');
+	const size_t last = digits.find_last_not_of('0');
+	return first == std::string::npos ? 1 : static_cast<int>(last - first + 1);
+}
+
+// Check if some decimal with n significant digits reads back as v, trying
+// the decimal nearest to it and the ones either side
+bool round_trips_with(float v, int n) {
+	char buf[64];
+	std::snprintf(buf, sizeof(buf), "%.*e", n - 1, v);
+	const char *e = std::strchr(buf, 'e');
+	long long digits = 0;
+	for (const char *c = buf; c < e; ++c) {
+		if (*c >= '0' && *c <= '9') {
+			digits = digits * 10 + (*c - '0');
+		}
+	}
+	const int exp = std::atoi(e + 1) - (n - 1);
+	for (long long d = digits - 1; d <= digits + 1; ++d) {
+		std::snprintf(buf, sizeof(buf), "%llde%d", d, exp);
+		if (d > 0 && std::strtof(buf, nullptr) == v) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	size_t count = 1000000;
+	unsigned seed = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-n") == 0) {
+			count = std::strtoull(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "-seed") == 0) {
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			std::cout << "Usage: ./nlxml_float_bench [-n <count>] [-seed <seed>]\n";
+			return 1;
+		}
+	}
+
+	const char *formats[] = {"%.2f", "%.3f", "%.6f", "%.8g", "%g", "%.9e", "%.12f"};
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> coords(-20000.0, 20000.0);
+	std::uniform_real_distribution<double> diameters(0.0, 10.0);
+	std::uniform_int_distribution<size_t> pick_format(0, sizeof(formats) / sizeof(formats[0]) - 1);
+
+	std::vector<std::string> strs;
+	strs.reserve(count);
+	char buf[64];
+	for (size_t i = 0; i < count; ++i) {
+		const double v = i % 4 == 3 ? diameters(rng) : coords(rng);
+		std::snprintf(buf, sizeof(buf), formats[pick_format(rng)], v);
+		strs.push_back(buf);
+	}
+
+	std::vector<float> fast(count), scanf(count);
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	for (size_t i = 0; i < count; ++i) {
+		tinyxml2::XMLUtil::ToFloat(strs[i].c_str(), &scanf[i]);
+	}
+	const double scanf_time = std::chrono::duration<double>(clock::now() - start).count();
+
+	start = clock::now();
+	for (size_t i = 0; i < count; ++i) {
+		nlxml::detail::parse_float(strs[i].data(), strs[i].data() + strs[i].size(), &fast[i]);
+	}
+	const double fast_time = std::chrono::duration<double>(clock::now() - start).count();
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (std::memcmp(&fast[i], &scanf[i], sizeof(float)) != 0) {
+			if (mismatches < 10) {
+				std::cout << "Mismatch parsing '" << strs[i] << "': sscanf = " << scanf[i]
+					<< ", parse_float = " << fast[i] << "\n";
+			}
+			++mismatches;
+		}
+	}
+
+	std::cout << "Parsed " << count << " floats\n"
+		<< "sscanf:      " << scanf_time << "s (" << scanf_time * 1e9 / count << "ns/float)\n"
+		<< "parse_float: " << fast_time << "s (" << fast_time * 1e9 / count << "ns/float)\n"
+		<< "Speedup: " << scanf_time / fast_time << "x\n"
+		<< "Mismatches: " << mismatches << "\n";
+
+	const char *format_names[] = {"%.8g:    ", "shortest:", "fixed(3):"};
+	nlxml::ExportOptions options[3];
+	options[1].float_format = nlxml::FloatFormat::SHORTEST;
+	options[2].float_format = nlxml::FloatFormat::FIXED;
+	char out[nlxml::detail::MAX_FLOAT_CHARS];
+	std::cout << "Formatted " << count << " floats\n";
+	for (size_t f = 0; f < 3; ++f) {
+		size_t chars = 0;
+		start = clock::now();
+		for (size_t i = 0; i < count; ++i) {
+			chars += nlxml::detail::format_float(fast[i], options[f], out);
+		}
+		const double time = std::chrono::duration<double>(clock::now() - start).count();
+		std::cout << format_names[f] << " " << time << "s (" << time * 1e9 / count << "ns/float, "
+			<< static_cast<double>(chars) / count << " chars/float)\n";
+	}
+
+	size_t round_trip_failures = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const size_t len = nlxml::detail::format_float(fast[i], options[1], out);
+		out[len] = '\0';
+		float parsed;
+		tinyxml2::XMLUtil::ToFloat(out, &parsed);
+		if (std::memcmp(&parsed, &fast[i], sizeof(float)) != 0) {
+			if (round_trip_failures < 10) {
+				std::cout << "Shortest format of " << fast[i] << " '" << out << "' doesn't round-trip\n";
+			}
+			++round_trip_failures;
+		}
+	}
+	std::cout << "Round-trip failures: " << round_trip_failures << "\n";
+
+	std::vector<float> values(fast);
+	for (int e = -149; e < 128; ++e) {
+		const float p = std::ldexp(1.f, e);
+		values.push_back(std::nextafter(p, 0.f));
+		values.push_back(p);
+		values.push_back(std::nextafter(p, HUGE_VALF));
+	}
+	size_t too_long = 0;
+	for (const float v : values) {
+		if (!(v > 0) || !std::isfinite(v)) {
+			continue;
+		}
+		const size_t len = nlxml::detail::format_float(v, options[1], out);
+		out[len] = '\0';
+		const int n = significant_digits(out);
+		if (n > 1 && round_trips_with(v, n - 1)) {
+			if (too_long < 10) {
+				std::cout << "Shortest format of " << v << " '" << out << "' isn't the shortest\n";
+			}
+			++too_long;
+		}
+	}
+	std::cout << "Longer than shortest: " << too_long << "\n";
+	return mismatches == 0 && round_trip_failures == 0 && too_long == 0 ? 0 : 1;
+}
+
@@ -1,13 +1,58 @@
 #include <iostream>
+#include <cstring>
 #include "nlxml.h"
 
 using namespace nlxml;
 
+// Summarize the tables of a binary file without copying its points
+void print_binary_index(const std::string &fname) {
+	BinaryNeuronFile file(fname);
+	const FlatNeuronData &t = file.tables;
+	std::cout << "Binary file contains " << file.num_points() << " points, "
+		<< t.trees.size() << " trees, " << t.branches.size() << " branches, "
+		<< t.contours.size() << " contours, " << t.markers.size() << " markers, "
+		<< t.images.size() << " images and " << t.strings.size() << " strings\n";
+	for (size_t i = 0; i < t.trees.size(); ++i) {
+		const FlatBranch &root = t.branches[t.trees[i].root_branch];
+		std::cout << i << ": tree { type = " << t.strings[t.trees[i].type]
+			<< ", #branches = " << t.trees[i].num_branches
+			<< ", #root points = " << root.num_points << " }\n";
+	}
+}
+
+// List the top-level elements in the file without loading them
+void print_index(const std::string &fname) {
+	if (is_binary_file(fname)) {
+		print_binary_index(fname);
+		return;
+	}
+	const char *kinds[] = {"tree", "contour", "marker", "images"};
+	LazyNeuronFile file(fname);
+	std::cout << "File contains " << file.elements().size() << " top-level elements\n";
+	for (size_t i = 0; i < file.elements().size(); ++i) {
+		const ElementInfo &e = file.elements()[i];
+		std::cout << i << ": " << kinds[static_cast<int>(e.kind)]
+			<< " { bytes = [" << e.begin << ", " << e.end << ")";
+		if (!e.type.empty()) {
+			std::cout << ", type = " << e.type;
+		}
+		if (!e.name.empty()) {
+			std::cout << ", name = " << e.name;
+		}
+		std::cout << ", #points = " << e.num_points << " }\n";
+	}
+}
+
 int main(int argc, char **argv) {
 	if (argc < 2) {
-		std::cerr << "Usage: " << argv[0] << " <file.xml>\n";
+		std::cerr << "Usage: " << argv[0] << " <file.xml|file.bin> [-index]\n"
+			<< "\t-index will only list the top-level elements in the file\n";
 		return 1;
 	}
+	if (argc > 2 && std::strcmp(argv[2], "-index") == 0) {
+		print_index(argv[1]);
+		return 0;
+	}
 	NeuronData data = import_file(argv[1]);
 	std::cout << "File contains " << data.trees.size() << " trees and "
 		<< data.contours.size() << " contours\n";
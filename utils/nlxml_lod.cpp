@@ -0,0 +1,79 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include "nlxml.h"
+
+using namespace nlxml;
+
+void print_levels(const LODNeuronFile &file) {
+	for (size_t i = 0; i < file.num_levels(); ++i) {
+		std::cout << "Level " << i << ": tolerance " << file.tolerance(i) << "um, "
+			<< file.num_points(i) << " points\n";
+	}
+}
+
+/* This program builds a level of detail pyramid of an NLXML file for
+ * viewers, which can then load just the level they need. The levels are
+ * decimated with the tolerances t, t * f, t * f^2, ... given by -tolerance
+ * and -factor, the finest first. Forks and branch ends are kept at every
+ * level.
+ *
+ * the -info flag will list the levels of an existing LOD file
+ */
+int main(int argc, char **argv) {
+	std::string input, output;
+	size_t num_levels = 4;
+	float tolerance = 0.1f;
+	float factor = 4.f;
+	size_t num_threads = 1;
+	bool info = false;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-o") == 0) {
+			output = argv[++i];
+		} else if (std::strcmp(argv[i], "-levels") == 0) {
+			num_levels = std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "-tolerance") == 0) {
+			tolerance = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-factor") == 0) {
+			factor = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-threads") == 0) {
+			num_threads = std::strtoul(argv[++i], nullptr, 10);
+		} else if (std::strcmp(argv[i], "-info") == 0) {
+			info = true;
+		} else {
+			input = argv[i];
+		}
+	}
+	if (input.empty() || (output.empty() && !info)) {
+		std::cout << "Error: an input and output file are needed.\n"
+			<< "Usage: ./nlxml_lod <input> -o <output> [-levels <n>] [-tolerance <um>] [-factor <f>]"
+			<< " [-threads <n>]\n"
+			<< "       ./nlxml_lod -info <lod file>\n"
+			<< "\t-levels <n> writes n levels, 4 by default\n"
+			<< "\t-tolerance <um> is the decimation tolerance of the finest level, 0.1um by default\n"
+			<< "\t-factor <f> multiplies the tolerance from one level to the next, 4 by default\n"
+			<< "\t-threads <n> decimates on n threads, or all hardware threads if 0\n";
+		return 1;
+	}
+
+	if (info) {
+		print_levels(LODNeuronFile(input));
+		return 0;
+	}
+	if (num_levels == 0 || !(factor >= 1.f)) {
+		std::cout << "Error: at least one level and a factor of at least 1 are needed\n";
+		return 1;
+	}
+
+	std::vector<float> tolerances;
+	for (size_t i = 0; i < num_levels; ++i) {
+		tolerances.push_back(tolerance);
+		tolerance *= factor;
+	}
+	const NeuronData data = import_file(input);
+	save_lod(data, tolerances, output, num_threads);
+
+	print_levels(LODNeuronFile(output));
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstdlib>
 #include <algorithm>
 #include <vector>
 #include <algorithm>
@@ -8,46 +9,73 @@
 
 using namespace nlxml;
 
-void remove_degree2_nodes(Branch &b) {
-	while (b.branches.size() == 1) {
-		auto &deg2 = b.branches[0];
-		std::copy(deg2.points.begin(), deg2.points.end(), std::back_inserter(b.points));
-		std::copy(deg2.markers.begin(), deg2.markers.end(), std::back_inserter(b.markers));
-		std::copy(deg2.branches.begin(), deg2.branches.end(), std::back_inserter(b.branches));
-		b.branches.erase(b.branches.begin());
-	}
-	for (auto &c : b.branches) {
-		remove_degree2_nodes(c);
-	}
-}
-
 int main(int argc, char **argv) {
 	std::string input, output;
+	ExportOptions export_options;
+	DecimateOptions decimate_options;
+	bool decimate_points = false;
+	MergeOptions merge_options;
+	bool merge_points = false;
+	float radius_tolerance = -1.f;
 	for (int i = 1; i < argc; ++i) {
 		if (std::strcmp(argv[i], "-o") == 0) {
 			output = argv[++i];
+		} else if (std::strcmp(argv[i], "-shortest") == 0) {
+			export_options.float_format = FloatFormat::SHORTEST;
+		} else if (std::strcmp(argv[i], "-precision") == 0) {
+			export_options.float_format = FloatFormat::FIXED;
+			export_options.precision = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "-tolerance") == 0) {
+			decimate_points = true;
+			decimate_options.tolerance = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-radius-tolerance") == 0) {
+			decimate_points = true;
+			radius_tolerance = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-merge") == 0) {
+			merge_points = true;
+			merge_options.distance = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-snap") == 0) {
+			merge_options.snap_branch_starts = true;
+		} else if (std::strcmp(argv[i], "-threads") == 0) {
+			decimate_options.num_threads = std::strtoul(argv[++i], nullptr, 10);
+			merge_options.num_threads = decimate_options.num_threads;
 		} else {
 			input = argv[i];
 		}
 	}
 	if (input.empty() || output.empty()) {
 		std::cout << "Error: an input and output file are needed.\n"
-			<< "Usage: ./blah <input> -o <output>\n";
+			<< "Usage: ./nlxml_simplifier <input> -o <output> [-shortest] [-precision <n>]"
+			<< " [-merge <um> [-snap]] [-tolerance <um>] [-radius-tolerance <um>] [-threads <n>]\n"
+			<< "\t-merge merges points of a branch within this distance of each other\n"
+			<< "\t-snap moves branch start points within the merge distance onto the fork\n"
+			<< "\t-tolerance removes points within this distance of the line through the\n"
+			<< "\t points kept, and with a radius within this of the radius along it\n"
+			<< "\t-radius-tolerance sets the allowed radius difference separately\n"
+			<< "\t-threads <n> decimates on n threads, or all hardware threads if 0\n";
 		return 1;
 	}
 
 	NeuronData data = import_file(input);
 
 	// Go through and remove all degree-2 nodes
-	for (auto &t : data.trees) {
-		for (auto &b : t.branches) {
-			remove_degree2_nodes(b);
-		}
+	collapse_degree2(data);
+
+	// Merge repeated samples and places the trace crosses back over itself
+	if (merge_points) {
+		const size_t merged = merge_duplicates(data, merge_options);
+		std::cout << "Merged " << merged << " duplicate points\n";
 	}
 
-	// TODO: Go through and remove points which are extremely close to each other
+	// Remove the points the branches' shape and radius can do without
+	if (decimate_points) {
+		decimate_options.radius_tolerance = radius_tolerance < 0.f
+			? decimate_options.tolerance : radius_tolerance;
+		const size_t removed = decimate(data, decimate_options);
+		std::cout << "Removed " << removed << " points\n";
+	}
 
-	export_file(data, output);
+	export_file(data, output, export_options);
 	return 0;
 }
 
@@ -1,5 +1,9 @@
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <fstream>
+#include <stdexcept>
 #include <algorithm>
 #include <vector>
 #include <algorithm>
@@ -9,99 +13,43 @@
 
 using namespace nlxml;
 
-void transform_branch(Branch &b, const glm::mat4 &transform) {
-	const auto apply_mat = [&](const Point &p) {
-		auto a = transform * glm::vec4(p.x, p.y, p.z, 1.f);
-		return nlxml::Point(a.x, a.y, a.z, p.d);
-	};
-
-	auto transform_points = [&](auto &points) {
-		std::transform(std::begin(points), std::end(points), std::begin(points), apply_mat);
-	};
-	auto transform_markers = [&](auto &markers) {
-		for (auto &m : markers) {
-			transform_points(m.points);
-		}
-	};
-	transform_points(b.points);
-	transform_markers(b.markers);
-	for (auto &child_b : b.branches) {
-		transform_branch(child_b, transform);
-	}
-}
-void transform_neuron_data(NeuronData &inout, const glm::mat4 &transform) {
-	const auto apply_mat = [&](const Point &p) {
-		auto a = transform * glm::vec4(p.x, p.y, p.z, 1.f);
-		return nlxml::Point(a.x, a.y, a.z, p.d);
-	};
-	auto transform_points = [&](auto &points) {
-		std::transform(std::begin(points), std::end(points), std::begin(points), apply_mat);
-	};
-	auto transform_markers = [&](auto &markers) {
-		for (auto &m : markers) {
-			transform_points(m.points);
+// Convert the trees to SWC as they're parsed, without loading the whole file
+void stream_swc(const std::string &input, const std::string &output, ImportOptions options,
+		const SWCExportOptions &swc_options, std::ostream &log)
+{
+	const LazyNeuronFile file(input);
+
+	std::ofstream fout;
+	std::unique_ptr<SWCStreamWriter> writer;
+	if (output == "-") {
+		writer.reset(new SWCStreamWriter(stdout, swc_options));
+	} else {
+		fout.open(output.c_str());
+		if (!fout) {
+			throw std::runtime_error("Error: failed to open " + output + " for writing");
 		}
-	};
-	for (auto &t : inout.trees) {
-		transform_points(t.points);
-		for (auto &b : t.branches) {
-			transform_branch(b, transform);
-		}
-		transform_markers(t.markers);
-	}
-	transform_markers(inout.markers);
-}
-
-void remove_degree2_nodes(Branch &b) {
-	while (b.branches.size() == 1) {
-		auto &deg2 = b.branches[0];
-		std::copy(deg2.points.begin(), deg2.points.end(), std::back_inserter(b.points));
-		std::copy(deg2.markers.begin(), deg2.markers.end(), std::back_inserter(b.markers));
-		std::copy(deg2.branches.begin(), deg2.branches.end(), std::back_inserter(b.branches));
-		b.branches.erase(b.branches.begin());
-	}
-	for (auto &c : b.branches) {
-		remove_degree2_nodes(c);
+		writer.reset(new SWCStreamWriter(fout, swc_options));
 	}
-}
-
-// Write the branch and sub-branches out in SWC, returns the id of the last point on this branch
-template<typename B>
-size_t write_branch_swc(std::ostream &os, const B &b, int parent_id, size_t point_id) {
-	for (size_t i = 0; i < b.points.size(); ++i) {
-		const auto &p = b.points[i];
 
-		os << point_id << " ";
-		if (parent_id == -1) {
-			// Start point
-			os << "1 ";
-		} else if (i + 1 == b.points.size()) {
-			if (!b.branches.empty()) {
-				// Fork point
-				os << "5 ";
-			} else {
-				// End point
-				os << "6 ";
-			}
-		} else {
-			// regular point 
-			os << "0 ";
+	options.branch_markers = false;
+	size_t num_trees = 0;
+	for (size_t i = 0; i < file.elements().size(); ++i) {
+		if (file.elements()[i].kind == ElementKind::TREE) {
+			file.parse_element(i, *writer, options);
+			++num_trees;
 		}
-
-		os << p.x << " " << p.y << " " << p.z << " 1 " << parent_id << "\n";
-
-		parent_id = point_id;
-		++point_id;
 	}
-	for (const auto &b : b.branches) {
-		point_id = write_branch_swc(os, b, parent_id, point_id);
+	writer->finish();
+	if (num_trees > 1) {
+		log << "There should just be one tree!\n";
 	}
-	return point_id;
 }
 
 int main(int argc, char **argv) {
 	std::string input, output, output_xml;
 	bool apply_file_tfm = false;
+	bool stream = false;
+	SWCExportOptions swc_options;
 	glm::mat4 user_translation(1.f);
 	glm::mat4 user_scale(1.f);
 	for (int i = 1; i < argc; ++i) {
@@ -111,6 +59,10 @@ int main(int argc, char **argv) {
 			output_xml = argv[++i];
 		} else if (std::strcmp(argv[i], "-apply") == 0) {
 			apply_file_tfm = true;
+		} else if (std::strcmp(argv[i], "-stream") == 0) {
+			stream = true;
+		} else if (std::strcmp(argv[i], "-structure-codes") == 0) {
+			swc_options.structure_codes = true;
 		} else if (std::strcmp(argv[i], "-translate") == 0) {
 			glm::vec3 v;
 			v.x = std::atof(argv[++i]);
@@ -129,26 +81,45 @@ int main(int argc, char **argv) {
 	}
 	if (input.empty() || (output.empty() && output_xml.empty())) {
 		std::cout << "Error: an input and output file are needed.\n"
-			<< "Usage: ./" << argv[0] << " <input> -o <output> [-oxml <output>]\n";
+			<< "Usage: ./" << argv[0] << " <input> -o <output> [-oxml <output>] [-structure-codes] [-stream]\n"
+			<< "Pass -o - to write the SWC file to stdout\n"
+			<< "-stream converts the trees of an XML file as they're read, in memory independent of\n"
+			<< "the file size. Binary files are always loaded whole\n";
 		return 1;
 	}
-
-	NeuronData data = import_file(input);
-
-	// Remove all degree-2 nodes (branches w/o points)
-	for (auto &t : data.trees) {
-		for (auto &b : t.branches) {
-			remove_degree2_nodes(b);
-		}
+	if (stream && (output.empty() || !output_xml.empty())) {
+		std::cout << "Error: -stream only writes an SWC file, pass -o <output> and not -oxml\n";
+		return 1;
+	}
+	// Keep stdout clean for the SWC data when piping it
+	const bool to_stdout = output == "-";
+	std::ostream &log = to_stdout ? std::cerr : std::cout;
+	swc_options.comment = "Converted from NLXML file " + input;
+
+	// Transform the points into the image's voxel space as they're imported
+	const glm::mat4 user_tfm = user_translation * user_scale;
+	ImportOptions import_options;
+	import_options.matrix.assign(glm::value_ptr(user_tfm), glm::value_ptr(user_tfm) + 16);
+	if (apply_file_tfm) {
+		import_options.image_transform = ImageTransform::INVERT;
 	}
 
-	glm::mat4 file_mat(1);
-	if (apply_file_tfm && !data.images.empty()) {
-		file_mat = glm::translate(glm::vec3(data.images[0].coord[0], data.images[0].coord[1], data.images[0].coord[2]))
-			* glm::scale(glm::vec3(data.images[0].scale[0], data.images[0].scale[1], data.images[0].z_spacing));
+	// Streaming reads the XML elements lazily, binary files are already
+	// compact and mapped so they're just converted the usual way
+	if (stream && is_binary_file(input)) {
+		log << input << " is a binary file, converting it without -stream\n";
+		stream = false;
+	}
+	if (stream) {
+		log << "Streaming converted SWC file " << output << "\n";
+		stream_swc(input, output, import_options, swc_options, log);
+		return 0;
 	}
-	const glm::mat4 tfm = user_translation * user_scale * glm::inverse(file_mat);
-	transform_neuron_data(data, tfm);
+
+	NeuronData data = import_file(input, import_options);
+
+	// Remove all degree-2 nodes (branches w/o points)
+	collapse_degree2(data);
 
 	/* Write out the SWC file (http://research.mssm.edu/cnic/swc.html)
 	 * File format is a bunch of lines in ASCII with numbers specifying:
@@ -173,27 +144,28 @@ int main(int argc, char **argv) {
 	 *
 	 * x, y, z gives the cartesian coordinates of each node.
 	 *
-	 * R is the radius at that node.
+	 * R is the radius at that node, half the NLXML point diameter.
 	 *
 	 * P indicates the parent (the integer label) of the current point
 	 * or -1 to indicate an origin (soma). 
+	 *
+	 * Points get the type code of their tree, or with -structure-codes the
+	 * start, fork and end point codes.
 	 */
 	if (!output.empty()) {
-		std::cout << "Exporting transformed and converted SWC file " << output << "\n";
-		std::ofstream fout(output.c_str());
-		fout << "# Converted from NLXML file " << input << "\n";
+		log << "Exporting transformed and converted SWC file " << output << "\n";
 		if (data.trees.size() > 1) {
-			std::cout << "There should just be one tree!\n";
+			log << "There should just be one tree!\n";
 		}
-
-		size_t point_id = 1;
-		for (const auto &t : data.trees) {
-			point_id = write_branch_swc(fout, t, -1, point_id);
+		if (to_stdout) {
+			export_swc_file(data, stdout, swc_options);
+		} else {
+			export_swc(data, output, swc_options);
 		}
 	}
 
 	if (!output_xml.empty()) {
-		std::cout << "Exporting transformed NLXML file " << output_xml << "\n";
+		log << "Exporting transformed NLXML file " << output_xml << "\n";
 		for (auto &img : data.images) {
 			img.coord.fill(0.f);
 			img.scale.fill(1.f);
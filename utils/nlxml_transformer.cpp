@@ -1,43 +1,19 @@
 #include <iostream>
+#include <cstdlib>
 #include <algorithm>
-#include <functional>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include "nlxml.h"
 
 using namespace nlxml;
 
-template<typename F>
-void transform_neuron_data(nlxml::NeuronData &inout, const F &transform) {
-	auto transform_points = [&](auto &points) {
-		std::transform(std::begin(points), std::end(points), std::begin(points), transform);
-	};
-
-	auto transform_markers = [&](auto &markers) {
-		for (auto &m : markers) {
-			transform_points(m.points);
-		}
-	};
-
-	std::function<void(nlxml::Branch &)> transform_branch = [&](nlxml::Branch &b) {
-		transform_points(b.points);
-		transform_markers(b.markers);
-		for (auto &child_b : b.branches) {
-			transform_branch(child_b);
-		}
-	};
-
-	for (auto &t : inout.trees) {
-		transform_points(t.points);
-
-		for (auto &b : t.branches) {
-			transform_branch(b);
-		}
-
-		transform_markers(t.markers);
-	}
-
-	transform_markers(inout.markers);
+// Import just the images of the file
+std::vector<Image> import_images(const std::string &fname) {
+	ImportOptions options;
+	options.contours = false;
+	options.markers = false;
+	options.tree_filter = [](const std::string &) { return false; };
+	return import_file(fname, options).images;
 }
 
 /* This program will take an NLXML file and apply its image transform
@@ -53,11 +29,20 @@ void transform_neuron_data(nlxml::NeuronData &inout, const F &transform) {
  * other points.
  *
  * the -flip-z will flip the z coordinates of all points in the file
+ *
+ * the -shortest and -precision <n> flags pick how coordinates are written,
+ * either as the fewest digits which read back exactly or rounded to n
+ * decimal places
+ *
+ * the -threads <n> flag imports and transforms the points on n threads, the
+ * output is the same for any number of threads
  */
 int main(int argc, char **argv) {
 	std::string input, output, to_space, apply;
 	bool make_nl_start = false;
 	bool flip_z = false;
+	ExportOptions export_options;
+	size_t num_threads = 1;
 	for (int i = 1; i < argc; ++i) {
 		if (std::strcmp(argv[i], "-o") == 0) {
 			output = argv[++i];
@@ -71,12 +56,22 @@ int main(int argc, char **argv) {
 				<< "\t-to-space will transform the input into the space of the specified file\n"
 				<< "\t-apply will take the transform from the file and apply it to this one\n"
 				<< "\t-make-nl-start will turn the first point on the tree in the file into a marker\n"
-				<< "\t-flip-z will flip the z coordinates of all points\n";
+				<< "\t-flip-z will flip the z coordinates of all points\n"
+				<< "\t-shortest will write the fewest digits which read back as the same coordinates\n"
+				<< "\t-precision <n> will round the coordinates written to n decimal places\n"
+				<< "\t-threads <n> will import and transform the points on n threads, or all hardware threads if 0\n";
 			return 0;
 		} else if (std::strcmp(argv[i], "-make-nl-start") == 0) {
 			make_nl_start = true;
 		} else if (std::strcmp(argv[i], "-flip-z") == 0) {
 			flip_z = true;
+		} else if (std::strcmp(argv[i], "-shortest") == 0) {
+			export_options.float_format = FloatFormat::SHORTEST;
+		} else if (std::strcmp(argv[i], "-precision") == 0) {
+			export_options.float_format = FloatFormat::FIXED;
+			export_options.precision = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "-threads") == 0) {
+			num_threads = std::strtoul(argv[++i], nullptr, 10);
 		} else {
 			input = argv[i];
 		}
@@ -91,62 +86,63 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	NeuronData data = import_file(input);
-	if (apply.empty() && to_space.empty() && data.images.empty()) {
+	// Only the images are read to find the transform, the points are then
+	// transformed as the file is imported
+	const std::vector<Image> images = import_images(input);
+	if (apply.empty() && to_space.empty() && images.empty()) {
 		std::cout << "Warning: did not find transform data in '" << input << "'\n";
-		export_file(data, output);
+		export_file(import_file(input), output, export_options);
 		return 0;
 	}
-	if (make_nl_start && (data.trees.empty() || data.trees[0].points.empty())) {
-		std::cout << "Error: no trees in file to make start point from\n";
-		return 1;
-	}
 
 	const float z_scale = flip_z ? -1.f : 1.f;
 
-	NeuronData to_data;
+	std::vector<Image> to_images;
 	glm::mat4 mat(1);
 	if (!to_space.empty()) {
-		to_data = import_file(to_space);
+		to_images = import_images(to_space);
 		// TODO: are these transforms correct in general? Some files have a transform
 		// already, so ignoring it is incorrect.
 		glm::mat4 from_mat(1);
 #if 0
-		if (!data.images.empty()) {
-			from_mat = glm::translate(glm::vec3(data.images[0].coord[0],
-						data.images[0].coord[1], data.images[0].coord[2]))
-				* glm::scale(glm::vec3(data.images[0].scale[0], data.images[0].scale[1],
-							data.images[0].z_spacing * z_scale));
+		if (!images.empty()) {
+			from_mat = glm::translate(glm::vec3(images[0].coord[0],
+						images[0].coord[1], images[0].coord[2]))
+				* glm::scale(glm::vec3(images[0].scale[0], images[0].scale[1],
+							images[0].z_spacing * z_scale));
 		}
 #endif
 		glm::mat4 to_mat(1);
-		if (!to_data.images.empty()) {
-			to_mat = glm::translate(glm::vec3(to_data.images[0].coord[0],
-						to_data.images[0].coord[1], to_data.images[0].coord[2]))
-				* glm::scale(glm::vec3(to_data.images[0].scale[0], to_data.images[0].scale[1],
-							to_data.images[0].z_spacing * z_scale));
+		if (!to_images.empty()) {
+			to_mat = glm::translate(glm::vec3(to_images[0].coord[0],
+						to_images[0].coord[1], to_images[0].coord[2]))
+				* glm::scale(glm::vec3(to_images[0].scale[0], to_images[0].scale[1],
+							to_images[0].z_spacing * z_scale));
 		}
 		// Shouldn't we apply to_mat, not its inverse? or apply from mat
 		// not its inverse?
 		mat = glm::inverse(to_mat) * glm::inverse(from_mat);
 	} else if (!apply.empty()) {
-		NeuronData ap = import_file(apply);
-		mat = glm::translate(glm::vec3(ap.images[0].coord[0], ap.images[0].coord[1], ap.images[0].coord[2]))
-			* glm::scale(glm::vec3(ap.images[0].scale[0], ap.images[0].scale[1],
-						ap.images[0].z_spacing * z_scale));
+		const std::vector<Image> ap = import_images(apply);
+		mat = glm::translate(glm::vec3(ap[0].coord[0], ap[0].coord[1], ap[0].coord[2]))
+			* glm::scale(glm::vec3(ap[0].scale[0], ap[0].scale[1],
+						ap[0].z_spacing * z_scale));
 	} else {
-		mat = glm::translate(glm::vec3(data.images[0].coord[0], data.images[0].coord[1], data.images[0].coord[2]))
-			* glm::scale(glm::vec3(data.images[0].scale[0], data.images[0].scale[1], data.images[0].z_spacing * z_scale));
+		mat = glm::translate(glm::vec3(images[0].coord[0], images[0].coord[1], images[0].coord[2]))
+			* glm::scale(glm::vec3(images[0].scale[0], images[0].scale[1], images[0].z_spacing * z_scale));
 	}
 
-	transform_neuron_data(data,
-		[mat](const Point &p) {
-			auto a = mat * glm::vec4(p.x, p.y, p.z, 1.f);
-			return nlxml::Point(a.x, a.y, a.z, p.d);
-		});
+	ImportOptions import_options;
+	import_options.matrix.assign(glm::value_ptr(mat), glm::value_ptr(mat) + 16);
+	import_options.num_threads = num_threads;
+	NeuronData data = import_file(input, import_options);
+	if (make_nl_start && (data.trees.empty() || data.trees[0].points.empty())) {
+		std::cout << "Error: no trees in file to make start point from\n";
+		return 1;
+	}
 
 	if (!to_space.empty()) {
-		data.images = to_data.images;
+		data.images = to_images;
 	} else if (!data.images.empty()) {
 		// Set the transform to identity now that we've applied it
 		data.images[0].coord.fill(0.f);
@@ -162,7 +158,7 @@ int main(int argc, char **argv) {
 		data.markers.push_back(start_pt);
 	}
 
-	export_file(data, output);
+	export_file(data, output, export_options);
 	return 0;
 }
 